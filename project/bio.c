@@ -1,6 +1,6 @@
 // Buffer cache.
 //
-// The buffer cache is a linked list of buf structures holding
+// The buffer cache is a hash table of buf structures holding
 // cached copies of disk block contents.  Caching disk blocks
 // in memory reduces the number of disk reads and also provides
 // a synchronization point for disk blocks used by multiple processes.
@@ -17,79 +17,293 @@
 // * B_VALID: the buffer data has been read from the disk.
 // * B_DIRTY: the buffer data has been modified
 //     and needs to be written to disk.
+//
+// Buffers live in pages from kalloc().  The cache grows to
+// 1/BCACHE_FRAC of physical memory.  Under memory pressure kalloc()
+// calls bshrink() to take back pages whose buffers are all idle,
+// down to NBUF buffers plus those the log may be holding (see
+// breserve()), and bget() grows the cache back when pages are free
+// again.
+//
+// Locking:
+// * Each hash bucket has a lock that protects its chain and the
+//   refcnt of the buffers on it.  A cache hit takes only that.
+// * bcache.lock serializes misses, growing and shrinking.  Only
+//   its holder may hold more than one bucket lock, so the order
+//   among bucket locks does not matter.
+// * bcache.lrulock protects the LRU list of buffers with
+//   refcnt 0, and lruwait.  Only sleep() and wakeup() acquire
+//   anything while holding it.
 
 #include "types.h"
 #include "defs.h"
 #include "param.h"
+#include "memlayout.h"
+#include "mmu.h"
 #include "spinlock.h"
 #include "sleeplock.h"
 #include "fs.h"
 #include "buf.h"
 
+#define NBUCKET 31
+#define BHASH(dev, blockno) (((dev) * 61 + (blockno)) % NBUCKET)
+#define NODEV ((uint)-1)  // dev of a buffer not on any hash chain
+
+// Header at the start of each page of buffers.
+struct bpage {
+  struct bpage *next;
+  struct buf buf[];
+};
+
+#define BPERPAGE ((PGSIZE - sizeof(struct bpage)) / sizeof(struct buf))
+#define MINPAGES ((NBUF + BPERPAGE - 1) / BPERPAGE)
+
+struct bucket {
+  struct spinlock lock;
+  struct buf *head;
+};
+
 struct {
   struct spinlock lock;
-  struct buf buf[NBUF];
+  struct bucket bucket[NBUCKET];
+  struct bpage *pages;
+  int npages;
+  int target;           // pages to grow back to
 
-  // Linked list of all buffers, through prev/next.
-  // head.next is most recently used.
-  struct buf head;
+  // Unused buffers, through prev/next.
+  // lru.next is most recently used.
+  struct spinlock lrulock;
+  struct buf lru;
+  int lruwait;          // bget() sleeps for a buffer to come free
 } bcache;
 
+static void
+lruinsert(struct buf *b, int head)
+{
+  acquire(&bcache.lrulock);
+  if(head){
+    b->next = bcache.lru.next;
+    b->prev = &bcache.lru;
+  } else {
+    b->next = &bcache.lru;
+    b->prev = bcache.lru.prev;
+  }
+  b->next->prev = b;
+  b->prev->next = b;
+  if(bcache.lruwait){
+    bcache.lruwait = 0;
+    wakeup(&bcache.lru);
+  }
+  release(&bcache.lrulock);
+}
+
+// Is there a buffer that bget() could recycle?
+// Caller holds bcache.lrulock.
+static struct buf*
+lruclean(void)
+{
+  struct buf *b;
+
+  for(b = bcache.lru.prev; b != &bcache.lru; b = b->prev)
+    if((b->flags & B_DIRTY) == 0)
+      return b;
+  return 0;
+}
+
+static void
+lruremove(struct buf *b)
+{
+  acquire(&bcache.lrulock);
+  b->next->prev = b->prev;
+  b->prev->next = b->next;
+  release(&bcache.lrulock);
+}
+
+static struct bucket*
+bucketof(struct buf *b)
+{
+  if(b->dev == NODEV)
+    return 0;
+  return &bcache.bucket[BHASH(b->dev, b->blockno)];
+}
+
+static void
+unhash(struct bucket *bk, struct buf *b)
+{
+  struct buf **pp;
+
+  for(pp = &bk->head; *pp != b; pp = &(*pp)->hnext)
+    if(*pp == 0)
+      panic("unhash");
+  *pp = b->hnext;
+}
+
+// Add the page bp of buffers to the cache.  Caller holds
+// bcache.lock.
+static void
+baddpage(struct bpage *bp)
+{
+  struct buf *b;
+
+  for(b = bp->buf; b < bp->buf + BPERPAGE; b++){
+    b->dev = NODEV;
+    b->flags = 0;
+    b->refcnt = 0;
+    initsleeplock(&b->lock, "buffer");
+    lruinsert(b, 0);
+  }
+  bp->next = bcache.pages;
+  bcache.pages = bp;
+  bcache.npages++;
+}
+
+// Add a page of buffers, if a page is free.  Caller holds
+// bcache.lock.  Uses only free memory: bget() runs on the swap
+// path, so it must not push pages out to make room.
+static int
+bgrow(void)
+{
+  struct bpage *bp;
+
+  if((bp = (struct bpage*)ktryalloc()) == 0)
+    return 0;
+  baddpage(bp);
+  return 1;
+}
+
 void
 binit(void)
 {
-  struct buf *b;
+  struct bucket *bk;
 
   initlock(&bcache.lock, "bcache");
+  initlock(&bcache.lrulock, "bcache.lru");
+  for(bk = bcache.bucket; bk < bcache.bucket+NBUCKET; bk++)
+    initlock(&bk->lock, "bcache.bucket");
 
 //PAGEBREAK!
-  // Create linked list of buffers
-  bcache.head.prev = &bcache.head;
-  bcache.head.next = &bcache.head;
-  for(b = bcache.buf; b < bcache.buf+NBUF; b++){
-    b->next = bcache.head.next;
-    b->prev = &bcache.head;
-    initsleeplock(&b->lock, "buffer");
-    bcache.head.next->prev = b;
-    bcache.head.next = b;
+  bcache.lru.prev = &bcache.lru;
+  bcache.lru.next = &bcache.lru;
+  bcache.target = PHYSTOP / PGSIZE / BCACHE_FRAC;
+  if(bcache.target < MINPAGES)
+    bcache.target = MINPAGES;
+  acquire(&bcache.lock);
+  while(bcache.npages < bcache.target && bgrow())
+    ;
+  if(bcache.npages < MINPAGES)
+    panic("binit");
+  release(&bcache.lock);
+}
+
+// Look for the block in bucket bk, and if it is there take a
+// reference to it, unless ahead is set.  Caller holds bk->lock.
+static struct buf*
+bfind(struct bucket *bk, uint dev, uint blockno, int ahead)
+{
+  struct buf *b;
+
+  for(b = bk->head; b; b = b->hnext){
+    if(b->dev == dev && b->blockno == blockno){
+      if(!ahead && b->refcnt++ == 0)
+        lruremove(b);
+      return b;
+    }
   }
+  return 0;
 }
 
 // Look through buffer cache for block on device dev.
-// If not found, allocate a buffer.
+// If not found, allocate a buffer, waiting for one to come free
+// if all are in use and the cache cannot grow.
 // In either case, return locked buffer.
+// For read-ahead (ahead set), return 0 instead if the block is
+// cached already or no buffer is free.
 static struct buf*
-bget(uint dev, uint blockno)
+bget(uint dev, uint blockno, int ahead)
 {
+  struct bucket *bk, *ob = 0;
   struct buf *b;
 
-  acquire(&bcache.lock);
+  bk = &bcache.bucket[BHASH(dev, blockno)];
+again:
+  acquire(&bk->lock);
+  b = bfind(bk, dev, blockno, ahead);
+  release(&bk->lock);
+  if(b){
+    if(ahead)
+      return 0;
+    acquiresleep(&b->lock);
+    return b;
+  }
 
-  // Is the block already cached?
-  for(b = bcache.head.next; b != &bcache.head; b = b->next){
-    if(b->dev == dev && b->blockno == blockno){
-      b->refcnt++;
-      release(&bcache.lock);
-      acquiresleep(&b->lock);
-      return b;
-    }
+  // Not cached.  Look again with bcache.lock held, since another
+  // process may have read the block in meanwhile.
+  acquire(&bcache.lock);
+  acquire(&bk->lock);
+  if((b = bfind(bk, dev, blockno, ahead)) != 0){
+    release(&bk->lock);
+    release(&bcache.lock);
+    if(ahead)
+      return 0;
+    acquiresleep(&b->lock);
+    return b;
   }
 
-  // Not cached; recycle an unused buffer.
+  if(bcache.npages < bcache.target)
+    bgrow();
+
+  // Recycle the least recently used buffer.
   // Even if refcnt==0, B_DIRTY indicates a buffer is in use
   // because log.c has modified it but not yet committed it.
-  for(b = bcache.head.prev; b != &bcache.head; b = b->prev){
-    if(b->refcnt == 0 && (b->flags & B_DIRTY) == 0) {
-      b->dev = dev;
-      b->blockno = blockno;
-      b->flags = 0;
-      b->refcnt = 1;
+  for(;;){
+    acquire(&bcache.lrulock);
+    b = lruclean();
+    release(&bcache.lrulock);
+    if(b == 0){
+      if(bgrow())
+        continue;
+      release(&bk->lock);
       release(&bcache.lock);
-      acquiresleep(&b->lock);
-      return b;
+      if(ahead)
+        return 0;
+      // Every buffer is held or waits for the log to commit.
+      // Both end in brelse(), which puts a buffer back on the
+      // LRU list; then look for the block all over again.
+      acquire(&bcache.lrulock);
+      while(lruclean() == 0){
+        bcache.lruwait = 1;
+        sleep(&bcache.lru, &bcache.lrulock);
+      }
+      release(&bcache.lrulock);
+      goto again;
     }
+    // Only bcache.lock's holder renames a buffer, so b stays on
+    // bucket ob; but it may have been taken since we looked.
+    ob = bucketof(b);
+    if(ob && ob != bk)
+      acquire(&ob->lock);
+    if(b->refcnt == 0 && (b->flags & B_DIRTY) == 0)
+      break;
+    if(ob && ob != bk)
+      release(&ob->lock);
+  }
+
+  lruremove(b);
+  if(ob){
+    unhash(ob, b);
+    if(ob != bk)
+      release(&ob->lock);
   }
-  panic("bget: no buffers");
+  b->dev = dev;
+  b->blockno = blockno;
+  b->flags = 0;
+  b->refcnt = 1;
+  b->hnext = bk->head;
+  bk->head = b;
+  release(&bk->lock);
+  release(&bcache.lock);
+  acquiresleep(&b->lock);
+  return b;
 }
 
 // Return a locked buf with the contents of the indicated block.
@@ -98,7 +312,7 @@ bread(uint dev, uint blockno)
 {
   struct buf *b;
 
-  b = bget(dev, blockno);
+  b = bget(dev, blockno, 0);
   if((b->flags & B_VALID) == 0) {
     iderw(b);
   }
@@ -115,6 +329,91 @@ bwrite(struct buf *b)
   iderw(b);
 }
 
+// Read n consecutive blocks from blockno into bs, locked.
+// The blocks not cached are read with one call to iderwv(),
+// so the disk gets them as one request.
+void
+breadv(uint dev, uint blockno, struct buf **bs, int n)
+{
+  struct buf *miss[MAXIOBLOCKS];
+  int i, m;
+
+  if(n > MAXIOBLOCKS)
+    panic("breadv");
+  m = 0;
+  for(i = 0; i < n; i++){
+    bs[i] = bget(dev, blockno + i, 0);
+    if((bs[i]->flags & B_VALID) == 0)
+      miss[m++] = bs[i];
+  }
+  if(m > 0)
+    iderwv(miss, m);
+}
+
+// Like breadv(), but without reading the blocks in, for a
+// caller that is about to overwrite them whole.
+void
+bgetv(uint dev, uint blockno, struct buf **bs, int n)
+{
+  int i;
+
+  for(i = 0; i < n; i++)
+    bs[i] = bget(dev, blockno + i, 0);
+}
+
+// Start reading the n listed blocks into the cache, and return
+// without waiting for them.  Blocks already cached, or for which
+// no buffer is free, are skipped.  Each buffer stays locked until
+// the disk driver calls bdone(), so a bread() of a block still
+// in flight sleeps until its data is there.
+void
+breadahead(uint dev, uint *blocks, int n)
+{
+  struct buf *bs[MAXIOBLOCKS], *b;
+  int i, m;
+
+  if(n > MAXIOBLOCKS)
+    panic("breadahead");
+  m = 0;
+  for(i = 0; i < n; i++){
+    if((b = bget(dev, blocks[i], 1)) == 0)
+      continue;
+    b->flags |= B_ASYNC;
+    bs[m++] = b;
+  }
+  if(m > 0)
+    iderwasync(bs, m);
+}
+
+// Write out n locked buffers together.
+void
+bwritev(struct buf **bs, int n)
+{
+  int i;
+
+  for(i = 0; i < n; i++){
+    if(!holdingsleep(&bs[i]->lock))
+      panic("bwritev");
+    bs[i]->flags |= B_DIRTY;
+  }
+  iderwv(bs, n);
+}
+
+static void
+bunref(struct buf *b)
+{
+  struct bucket *bk;
+
+  bk = bucketof(b);
+  acquire(&bk->lock);
+  b->refcnt--;
+  if (b->refcnt == 0) {
+    // no one is waiting for it.
+    lruinsert(b, 1);
+  }
+  release(&bk->lock);
+}
+
 // Release a locked buffer.
 // Move to the head of the MRU list.
 void
@@ -124,21 +423,90 @@ brelse(struct buf *b)
     panic("brelse");
 
   releasesleep(&b->lock);
+  bunref(b);
+}
+
+// Called by the disk driver, possibly from an interrupt, when a
+// read started by breadahead() is done: the brelse() that its
+// starter never does.
+void
+bdone(struct buf *b)
+{
+  releasesleep(&b->lock);
+  bunref(b);
+}
+
+// Make sure the cache has room for n blocks of the log on top of
+// the NBUF buffers everything else needs.  The log keeps the blocks
+// of a transaction dirty in the cache until it commits, and its
+// commit needs NBUF more, so it must never find the cache short.
+// Called by begin_op() with no locks held: unlike bget(), it may
+// push user pages out to make room.
+void
+breserve(int n)
+{
+  char *mem;
 
   acquire(&bcache.lock);
-  b->refcnt--;
-  if (b->refcnt == 0) {
-    // no one is waiting for it.
-    b->next->prev = b->prev;
-    b->prev->next = b->next;
-    b->next = bcache.head.next;
-    b->prev = &bcache.head;
-    bcache.head.next->prev = b;
-    bcache.head.next = b;
-  }
-  
+  while(bcache.npages * BPERPAGE < NBUF + n){
+    release(&bcache.lock);
+    if((mem = kalloc()) == 0)
+      return;
+    acquire(&bcache.lock);
+    baddpage((struct bpage*)mem);
+  }
   release(&bcache.lock);
 }
+
+// Number of pages in the cache, for bcachesize().
+int
+bcachepages(void)
+{
+  return bcache.npages;
+}
+
+// Give a page of idle buffers back to kalloc(), keeping at least
+// NBUF buffers besides those the log may need.  Returns 1 if a
+// page was freed.
+int
+bshrink(void)
+{
+  struct bpage *bp, **pp;
+  struct bucket *bk;
+  struct buf *b;
+
+  acquire(&bcache.lock);
+  if((bcache.npages - 1) * BPERPAGE < NBUF + logblocks()){
+    release(&bcache.lock);
+    return 0;
+  }
+  for(bk = bcache.bucket; bk < bcache.bucket+NBUCKET; bk++)
+    acquire(&bk->lock);
+
+  for(pp = &bcache.pages; (bp = *pp) != 0; pp = &bp->next){
+    for(b = bp->buf; b < bp->buf + BPERPAGE; b++)
+      if(b->refcnt != 0 || (b->flags & B_DIRTY))
+        break;
+    if(b == bp->buf + BPERPAGE)
+      break;
+  }
+  if(bp){
+    for(b = bp->buf; b < bp->buf + BPERPAGE; b++){
+      lruremove(b);
+      if((bk = bucketof(b)) != 0)
+        unhash(bk, b);
+    }
+    *pp = bp->next;
+    bcache.npages--;
+  }
+
+  for(bk = bcache.bucket; bk < bcache.bucket+NBUCKET; bk++)
+    release(&bk->lock);
+  release(&bcache.lock);
+  if(bp == 0)
+    return 0;
+  kfree((char*)bp);
+  return 1;
+}
 //PAGEBREAK!
 // Blank page.
-
@@ -4,11 +4,14 @@ struct buf {
   uint blockno;
   struct sleeplock lock;
   uint refcnt;
-  struct buf *prev; // LRU cache list
+  struct buf *prev; // LRU list of unused buffers
   struct buf *next;
+  struct buf *hnext; // hash bucket chain
   struct buf *qnext; // disk queue
   uchar data[BSIZE];
 };
 #define B_VALID 0x2  // buffer has been read from disk
 #define B_DIRTY 0x4  // buffer needs to be written to disk
+#define B_ASYNC 0x8  // read started by breadahead(); the driver releases it
+#define B_ERROR 0x10 // the disk failed the last request for the buffer
 
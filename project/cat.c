@@ -2,15 +2,19 @@
 #include "stat.h"
 #include "user.h"
 
-char buf[512];
+char buf[BUFSIZ];
 
+// Copy fd to stdout a buffer at a time.  Writes go through
+// stdout's stream, so they are not interleaved with printf().
 void
 cat(int fd)
 {
+  FILE *out;
   int n;
 
+  out = fdopen(1);
   while((n = read(fd, buf, sizeof(buf))) > 0) {
-    if (write(1, buf, n) != n) {
+    if (fwrite(buf, 1, n, out) != n) {
       printf(1, "cat: write error\n");
       exit();
     }
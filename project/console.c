@@ -14,6 +14,7 @@
 #include "mmu.h"
 #include "proc.h"
 #include "x86.h"
+#include "poll.h"
 
 static void consputc(int);
 
@@ -184,6 +185,7 @@ struct {
   uint r;  // Read index
   uint w;  // Write index
   uint e;  // Edit index
+  int polled;  // a poller waits for input
 } input;
 
 #define C(x)  ((x)-'@')  // Control-x
@@ -221,6 +223,10 @@ consoleintr(int (*getc)(void))
         if(c == '\n' || c == C('D') || input.e == input.r+INPUT_BUF){
           input.w = input.e;
           wakeup(&input.r);
+          if(input.polled){
+            input.polled = 0;
+            pollwakeup();
+          }
         }
       }
       break;
@@ -285,6 +291,22 @@ consolewrite(struct inode *ip, char *buf, int n)
   return n;
 }
 
+// Input is ready once a line is complete; output never blocks.
+int
+consolepoll(struct inode *ip, int events)
+{
+  int r;
+
+  r = events & POLLOUT;
+  acquire(&cons.lock);
+  if(input.r != input.w)
+    r |= events & POLLIN;
+  else if(events & POLLIN)
+    input.polled = 1;
+  release(&cons.lock);
+  return r;
+}
+
 void
 consoleinit(void)
 {
@@ -292,6 +314,7 @@ consoleinit(void)
 
   devsw[CONSOLE].write = consolewrite;
   devsw[CONSOLE].read = consoleread;
+  devsw[CONSOLE].poll = consolepoll;
   cons.locking = 1;
 
   ioapicenable(IRQ_KBD, 0);
@@ -3,8 +3,13 @@ struct context;
 struct file;
 struct inode;
 struct pipe;
+struct pollfd;
 struct proc;
+struct replstat;
 struct rtcdate;
+struct wsstat;
+struct vma;
+struct page;
 struct spinlock;
 struct sleeplock;
 struct stat;
@@ -14,8 +19,16 @@ struct swap_slot;
 // bio.c
 void            binit(void);
 struct buf*     bread(uint, uint);
+void            breadv(uint, uint, struct buf**, int);
+void            bgetv(uint, uint, struct buf**, int);
 void            brelse(struct buf*);
+void            breadahead(uint, uint*, int);
+void            bdone(struct buf*);
+int             bshrink(void);
+void            breserve(int);
+int             bcachepages(void);
 void            bwrite(struct buf*);
+void            bwritev(struct buf**, int);
 
 // console.c
 void            consoleinit(void);
@@ -25,6 +38,8 @@ void            panic(char*) __attribute__((noreturn));
 
 // exec.c
 int             exec(char*, char**);
+char*           execname(char*);
+int             loadimage(char*, char**, pde_t**, uint*, uint*, uint*);
 
 // file.c
 struct file*    filealloc(void);
@@ -34,6 +49,8 @@ void            fileinit(void);
 int             fileread(struct file*, char*, int n);
 int             filestat(struct file*, struct stat*);
 int             filewrite(struct file*, char*, int n);
+int             filesplice(struct file*, struct file*, int);
+int             filepoll(struct file*, int);
 
 // fs.c
 void            readsb(int dev, struct superblock *sb);
@@ -51,6 +68,7 @@ int             namecmp(const char*, const char*);
 struct inode*   namei(char*);
 struct inode*   nameiparent(char*, char*);
 int             readi(struct inode*, char*, uint, uint);
+void            ireadahead(struct inode*, uint, int);
 void            stati(struct inode*, struct stat*);
 int             writei(struct inode*, char*, uint, uint);
 
@@ -58,6 +76,8 @@ int             writei(struct inode*, char*, uint, uint);
 void            ideinit(void);
 void            ideintr(void);
 void            iderw(struct buf*);
+void            iderwv(struct buf**, int);
+void            iderwasync(struct buf**, int);
 
 // ioapic.c
 void            ioapicenable(int irq, int cpu);
@@ -65,9 +85,19 @@ extern uchar    ioapicid;
 void            ioapicinit(void);
 
 // kalloc.c
+int             commit_charge(uint);
+void            commit_uncharge(uint);
+int             setovercommit(int);
 char*           kalloc(void);
+char*           ktryalloc(void);
 uint            num_of_FreePages(void);
+int             kavail(void);
 void            kfree(char*);
+void            kdup(char*);
+int             ktrydup(struct page*);
+struct page*    pa2page(uint);
+struct page*    framearray(int*);
+uint            page2pa(struct page*);
 void            kinit1(void*, void*);
 void            kinit2(void*, void*);
 
@@ -79,6 +109,7 @@ void            cmostime(struct rtcdate *r);
 int             lapicid(void);
 extern volatile uint*    lapic;
 void            lapiceoi(void);
+void            lapicipi(int, int);
 void            lapicinit(void);
 void            lapicstartap(uchar, uint);
 void            microdelay(int);
@@ -88,11 +119,17 @@ void            initlog(int dev);
 void            log_write(struct buf*);
 void            begin_op();
 void            end_op();
+int             logblocks(void);
 
 // mp.c
 extern int      ismp;
 void            mpinit(void);
 
+// pci.c
+int             pcifind(int, int, uint*);
+uint            pciread(uint, int);
+void            pciwrite(uint, int, uint);
+
 // picirq.c
 void            picenable(int);
 void            picinit(void);
@@ -100,16 +137,38 @@ void            picinit(void);
 // pipe.c
 int             pipealloc(struct file**, struct file**);
 void            pipeclose(struct pipe*, int);
-int             piperead(struct pipe*, char*, int);
-int             pipewrite(struct pipe*, char*, int);
+int             piperead(struct pipe*, char*, int, int);
+int             pipewrite(struct pipe*, char*, int, int);
+int             pipepoll(struct pipe*, int, int);
+int             pipeputpage(struct pipe*, char*, uint, int);
+int             pipegetpage(struct pipe*, char*, int, char**, uint*, int);
+int             pipesetsize(struct pipe*, int);
+int             pipegetsize(struct pipe*);
 
 //PAGEBREAK: 16
+// poll.c
+void            pollinit(void);
+void            pollwakeup(void);
+void            polltick(void);
+int             poll(struct pollfd*, int, int);
+
 // proc.c
 int             cpuid(void);
 void            exit(void);
 int             fork(void);
 int             growproc(int);
+struct proc*    lockpgdir(pde_t*);
+pde_t*          setpgdir(struct proc*, pde_t*);
+void            unlockpgdir(void);
+void            unpinshared(uint, uint);
+int             kproc(char*, void(*)(void));
 int             kill(int);
+void            loadcontrol(void);
+int             setrsslimit(int, int);
+void            loadwait(void);
+int             oom_kill(void);
+int             setoomadj(int, int);
+int             spawn(char*, char**, int*);
 struct cpu*     mycpu(void);
 struct proc*    myproc();
 void            pinit(void);
@@ -123,9 +182,9 @@ int             wait(void);
 void            wakeup(void*);
 void            yield(void);
 void            print_rss(void);
+struct proc*    pgdirproc(pde_t*);
 struct proc*    find_victim_process();
 pte_t*          find_victim_pte(struct proc*);
-void            clear_swap(pde_t*, struct proc*);
 void            freepage(pte_t*);
 
 
@@ -141,6 +200,26 @@ void            release(struct spinlock*);
 void            pushcli(void);
 void            popcli(void);
 
+// replace.c
+void            replinit(void);
+void            repl_map(struct page*);
+void            repl_unmap(struct page*);
+void            repl_sample(void);
+struct page*    repl_victim(pde_t*);
+void            repl_deactivate(struct page*);
+int             repl_pin(struct page*);
+void            repl_unpin(struct page*);
+void            repl_fault(void);
+int             setreplpolicy(int);
+int             getreplstat(int, struct replstat*);
+void            plist_init(struct page*);
+void            plist_add(struct page*, struct page*);
+void            plist_del(struct page*);
+pte_t*          replpte(struct page*);
+int             replreferenced(struct page*);
+int             replevictable(struct page*, pde_t*);
+int             repl_wssample(pde_t*, uint, uchar*, int);
+
 // sleeplock.c
 void            acquiresleep(struct sleeplock*);
 void            releasesleep(struct sleeplock*);
@@ -159,6 +238,7 @@ char*           strncpy(char*, const char*, int);
 // syscall.c
 int             argint(int, int*);
 int             argptr(int, char**, int);
+int             argptrw(int, char**, int);
 int             argstr(int, char**);
 int             fetchint(uint, int*);
 int             fetchstr(uint, char**);
@@ -185,22 +265,61 @@ pde_t*          setupkvm(void);
 char*           uva2ka(pde_t*, char*);
 int             allocuvm(pde_t*, uint, uint);
 int             deallocuvm(pde_t*, uint, uint);
+void            countuvm(pde_t*, uint, uint, uint*, uint*);
 void            freevm(pde_t*);
 void            inituvm(pde_t*, char*, uint);
 int             loaduvm(pde_t*, char*, struct inode*, uint, uint);
 pde_t*          copyuvm(pde_t*, uint);
 void            switchuvm(struct proc*);
+void            tlbflush(pde_t*);
 void            switchkvm(void);
 int             copyout(pde_t*, uint, void*, uint);
 void            clearpteu(pde_t *pgdir, char *uva);
 pte_t*          walkpgdir(pde_t *pgdir, const void *va, int alloc);
+int             mappage(pde_t*, uint, char*, int);
+char*           uvmloan(uint);
+int             cowfault(uint);
+int             madvise(uint, uint, int);
+int             mlock(uint, uint);
+int             munlock(uint, uint);
+
+// mmap.c
+int             mmap(uint, uint, int, int, struct file*, uint);
+int             munmap(uint, uint);
+int             msync(uint, uint);
+int             mmap_fault(struct proc*, uint);
+struct vma*     findvma(struct proc*, uint);
+int             mmap_fork(struct proc*, struct proc*);
+void            mmap_exit(struct proc*);
+uint            mmap_gap(struct proc*, uint);
+
+// shm.c
+void            shminit(void);
+int             shmget(char*, uint);
+int             shmat(int);
+int             shmdt(uint);
+int             shmrm(int);
+int             shm_fork(struct vma*, pde_t*);
+void            shm_detach(struct proc*, struct vma*);
+int             shm_fault(struct proc*, struct vma*, uint);
+int             shm_evict(struct page*, uint);
+int             shm_unevict(struct page*, uint);
 
 // pageswap.c
 void            swap_init(void);
 void            page_fault_handler(void);
-char*           swap_page_out();
-int             swap_page_in(pte_t*, struct proc*);
+char*           swap_page_out(pde_t*);
+void            rss_trim(struct proc*);
+int             swap_page_in(pte_t*, struct proc*, uint);
+int             swap_read(pte_t, char*);
+void            swap_prefetch(struct proc*, uint, uint);
+
 
+// wset.c
+void            wsinit(void);
+int             wsctl(int, int);
+int             wsread(struct wsstat*, uchar*, int);
+void            wstick(void);
 
 // number of elements in fixed-size array
 #define NELEM(x) (sizeof(x)/sizeof((x)[0]))
@@ -6,18 +6,22 @@
 #include "defs.h"
 #include "x86.h"
 #include "elf.h"
+#include "mman.h"
 
+// Load the program at path into a fresh page table and push argv
+// onto its user stack.  Fills in the new page table, image size,
+// entry point and initial stack pointer, but does not touch the
+// current process.  Shared by exec() and spawn().
+// Returns 0 on success, -1 on failure.
 int
-exec(char *path, char **argv)
+loadimage(char *path, char **argv, pde_t **pgdirp, uint *szp, uint *eipp, uint *espp)
 {
-  char *s, *last;
   int i, off;
   uint argc, sz, sp, ustack[3+MAXARG+1];
   struct elfhdr elf;
   struct inode *ip;
   struct proghdr ph;
-  pde_t *pgdir, *oldpgdir;
-  struct proc *curproc = myproc();
+  pde_t *pgdir;
 
   begin_op();
 
@@ -87,28 +91,64 @@ exec(char *path, char **argv)
   if(copyout(pgdir, sp, ustack, (3+argc+1)*4) < 0)
     goto bad;
 
-  // Save program name for debugging.
+  *pgdirp = pgdir;
+  *szp = sz;
+  *eipp = elf.entry;  // main
+  *espp = sp;
+  return 0;
+
+ bad:
+  if(pgdir)
+    freevm(pgdir);
+  if(ip){
+    iunlockput(ip);
+    end_op();
+  }
+  return -1;
+}
+
+// Return the last path component of path, for p->name.
+char*
+execname(char *path)
+{
+  char *s, *last;
+
   for(last=s=path; *s; s++)
     if(*s == '/')
       last = s+1;
-  safestrcpy(curproc->name, last, sizeof(curproc->name));
+  return last;
+}
+
+int
+exec(char *path, char **argv)
+{
+  uint sz, eip, sp;
+  pde_t *pgdir, *oldpgdir;
+  struct proc *curproc = myproc();
+
+  if(loadimage(path, argv, &pgdir, &sz, &eip, &sp) < 0)
+    return -1;
+  if(commit_charge(sz / PGSIZE) < 0){
+    freevm(pgdir);
+    return -1;
+  }
+
+  // Save program name for debugging.
+  safestrcpy(curproc->name, execname(path), sizeof(curproc->name));
 
   // Commit to the user image.
   oldpgdir = curproc->pgdir;
-  curproc->pgdir = pgdir;
+  mmap_exit(curproc);
+  commit_uncharge(PGROUNDUP(curproc->sz) / PGSIZE);
+  setpgdir(curproc, pgdir);
   curproc->sz = sz;
-  curproc->tf->eip = elf.entry;  // main
+  curproc->rss = sz;
+  curproc->swapsz = 0;
+  curproc->advice = MADV_NORMAL;
+  curproc->tf->eip = eip;
   curproc->tf->esp = sp;
   switchuvm(curproc);
   freevm(oldpgdir);
+  rss_trim(curproc);
   return 0;
-
- bad:
-  if(pgdir)
-    freevm(pgdir);
-  if(ip){
-    iunlockput(ip);
-    end_op();
-  }
-  return -1;
 }
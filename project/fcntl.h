@@ -2,3 +2,10 @@
 #define O_WRONLY  0x001
 #define O_RDWR    0x002
 #define O_CREATE  0x200
+#define O_NONBLOCK 0x800
+
+// fcntl() commands
+#define F_GETPIPE_SZ 1  // pipe buffer size in bytes
+#define F_SETPIPE_SZ 2  // resize a pipe buffer; returns the new size
+#define F_GETFL      3  // access mode and O_NONBLOCK
+#define F_SETFL      4  // set O_NONBLOCK from arg
@@ -5,10 +5,13 @@
 #include "types.h"
 #include "defs.h"
 #include "param.h"
+#include "stat.h"
+#include "mmu.h"
 #include "fs.h"
 #include "spinlock.h"
 #include "sleeplock.h"
 #include "file.h"
+#include "poll.h"
 
 struct devsw devsw[NDEV];
 struct {
@@ -32,6 +35,9 @@ filealloc(void)
   for(f = ftable.file; f < ftable.file + NFILE; f++){
     if(f->ref == 0){
       f->ref = 1;
+      f->nonblock = 0;
+      f->raoff = 0;
+      f->rawin = 0;
       release(&ftable.lock);
       return f;
     }
@@ -101,17 +107,53 @@ fileread(struct file *f, char *addr, int n)
   if(f->readable == 0)
     return -1;
   if(f->type == FD_PIPE)
-    return piperead(f->pipe, addr, n);
+    return piperead(f->pipe, addr, n, f->nonblock);
   if(f->type == FD_INODE){
+    if(f->nonblock && (filepoll(f, POLLIN) & POLLIN) == 0)
+      return -1;
     ilock(f->ip);
-    if((r = readi(f->ip, addr, f->off, n)) > 0)
+    if((r = readi(f->ip, addr, f->off, n)) > 0){
+      // A read that starts where the last one ended is
+      // sequential: read ahead of it, in a window that doubles
+      // with each such read.  Any other read closes the window.
+      if(f->off != f->raoff)
+        f->rawin = 0;
+      else if(f->rawin == 0)
+        f->rawin = 2;
+      else if(f->rawin < READAHEAD)
+        f->rawin *= 2;
       f->off += r;
+      f->raoff = f->off;
+      if(f->rawin > 0)
+        ireadahead(f->ip, f->off, f->rawin);
+    }
     iunlock(f->ip);
     return r;
   }
   panic("fileread");
 }
 
+// Return the events among events (POLL* in poll.h) that are ready
+// on f, plus POLLHUP or POLLERR for a pipe whose other end is
+// closed.  Files never block; devices can say otherwise.
+int
+filepoll(struct file *f, int events)
+{
+  struct inode *ip;
+
+  if(f->readable == 0)
+    events &= ~POLLIN;
+  if(f->writable == 0)
+    events &= ~POLLOUT;
+  if(f->type == FD_PIPE)
+    return pipepoll(f->pipe, f->writable, events);
+  ip = f->ip;
+  if(f->type == FD_INODE && ip->type == T_DEV && ip->major >= 0 &&
+     ip->major < NDEV && devsw[ip->major].poll)
+    return devsw[ip->major].poll(ip, events);
+  return events & (POLLIN|POLLOUT);
+}
+
 //PAGEBREAK!
 // Write to file f.
 int
@@ -122,7 +164,7 @@ filewrite(struct file *f, char *addr, int n)
   if(f->writable == 0)
     return -1;
   if(f->type == FD_PIPE)
-    return pipewrite(f->pipe, addr, n);
+    return pipewrite(f->pipe, addr, n, f->nonblock);
   if(f->type == FD_INODE){
     // write a few blocks at a time to avoid exceeding
     // the maximum log transaction size, including
@@ -155,3 +197,85 @@ filewrite(struct file *f, char *addr, int n)
   panic("filewrite");
 }
 
+
+//PAGEBREAK!
+// Move up to n bytes from file in to file out, one of which must
+// be a pipe, without copying them through user space.  Pages move
+// between pipes as they are; file data is read into a page that
+// is then queued in the pipe, or written to the file straight from
+// the pipe's page.  Blocks only until some data is available.
+int
+filesplice(struct file *in, struct file *out, int n)
+{
+  int r, m, i, done;
+  int max = ((MAXOPBLOCKS-1-1-2) / 2) * 512;
+  char *spare, *page;
+  uint off;
+
+  if(in->readable == 0 || out->writable == 0 || n < 0)
+    return -1;
+  if(in->type == FD_INODE && out->type == FD_PIPE){
+    for(done = 0; done < n; done += r){
+      if((page = kalloc()) == 0)
+        break;
+      m = n - done < PGSIZE ? n - done : PGSIZE;
+      ilock(in->ip);
+      if((r = readi(in->ip, page, in->off, m)) > 0)
+        in->off += r;
+      iunlock(in->ip);
+      if(r <= 0 || pipeputpage(out->pipe, page, 0, r) < 0){
+        kfree(page);
+        if(r != 0 && done == 0)
+          return -1;
+        break;
+      }
+    }
+    return done;
+  }
+  if(in->type != FD_PIPE || (out->type != FD_PIPE && out->type != FD_INODE))
+    return -1;
+
+  if((spare = kalloc()) == 0)
+    return -1;
+  r = 0;
+  for(done = 0; done < n; done += m){
+    m = pipegetpage(in->pipe, spare, n - done, &page, &off, done == 0);
+    if(m <= 0){
+      r = m;
+      break;
+    }
+    if(out->type == FD_PIPE){
+      if(pipeputpage(out->pipe, page, off, m) < 0){
+        if(page != spare)
+          kfree(page);
+        r = -1;
+        break;
+      }
+      // The out pipe has spare now.
+      if(page == spare && (spare = kalloc()) == 0){
+        done += m;
+        break;
+      }
+      continue;
+    }
+    for(i = 0; i < m; i += r){
+      begin_op();
+      ilock(out->ip);
+      if((r = writei(out->ip, page + off + i, out->off, m - i < max ? m - i : max)) > 0)
+        out->off += r;
+      iunlock(out->ip);
+      end_op();
+      if(r <= 0)
+        break;
+    }
+    if(page != spare)
+      kfree(page);
+    if(r <= 0){
+      r = -1;
+      break;
+    }
+  }
+  if(spare)
+    kfree(spare);
+  return done == 0 && r < 0 ? -1 : done;
+}
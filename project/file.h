@@ -3,9 +3,12 @@ struct file {
   int ref; // reference count
   char readable;
   char writable;
+  char nonblock;  // O_NONBLOCK: fail reads and writes that would block
   struct pipe *pipe;
   struct inode *ip;
   uint off;
+  uint raoff;     // where a sequential read would start
+  int rawin;      // read-ahead window, in blocks
 };
 
 
@@ -30,6 +33,7 @@ struct inode {
 struct devsw {
   int (*read)(struct inode*, char*, int);
   int (*write)(struct inode*, char*, int);
+  int (*poll)(struct inode*, int);  // ready events; see filepoll
 };
 
 extern struct devsw devsw[];
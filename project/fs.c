@@ -475,6 +475,25 @@ readi(struct inode *ip, char *dst, uint off, uint n)
   return n;
 }
 
+// Start reading the n blocks of ip that follow offset off into
+// the buffer cache, without waiting for them.  Stops at the end
+// of the file.  Caller must hold ip->lock.
+void
+ireadahead(struct inode *ip, uint off, int n)
+{
+  uint addrs[MAXIOBLOCKS], bn, end;
+  int m;
+
+  if(ip->type == T_DEV)
+    return;
+  end = (ip->size + BSIZE - 1) / BSIZE;
+  m = 0;
+  for(bn = off / BSIZE; bn < end && m < n && m < MAXIOBLOCKS; bn++)
+    addrs[m++] = bmap(ip, bn);
+  if(m > 0)
+    breadahead(ip->dev, addrs, m);
+}
+
 // PAGEBREAK!
 // Write data to inode.
 // Caller must hold ip->lock.
@@ -8,29 +8,19 @@ char buf[1024];
 int match(char*, char*);
 
 void
-grep(char *pattern, int fd)
+grep(char *pattern, FILE *f)
 {
-  int n, m;
-  char *p, *q;
+  FILE *out;
+  int n;
 
-  m = 0;
-  while((n = read(fd, buf+m, sizeof(buf)-m-1)) > 0){
-    m += n;
-    buf[m] = '\0';
-    p = buf;
-    while((q = strchr(p, '\n')) != 0){
-      *q = 0;
-      if(match(pattern, p)){
-        *q = '\n';
-        write(1, p, q+1 - p);
-      }
-      p = q+1;
-    }
-    if(p == buf)
-      m = 0;
-    if(m > 0){
-      m -= p - buf;
-      memmove(buf, p, m);
+  out = fdopen(1);
+  while(fgets(buf, sizeof(buf), f)){
+    n = strlen(buf);
+    if(buf[n-1] == '\n')
+      buf[n-1] = 0;
+    if(match(pattern, buf)){
+      fputs(buf, out);
+      fputc('\n', out);
     }
   }
 }
@@ -48,7 +38,7 @@ main(int argc, char *argv[])
   pattern = argv[1];
 
   if(argc <= 2){
-    grep(pattern, 0);
+    grep(pattern, fdopen(0));
     exit();
   }
 
@@ -57,8 +47,8 @@ main(int argc, char *argv[])
       printf(1, "grep: cannot open %s\n", argv[i]);
       exit();
     }
-    grep(pattern, fd);
-    close(fd);
+    grep(pattern, fdopen(fd));
+    fclose(fdopen(fd));
   }
   exit();
 }
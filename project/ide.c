@@ -1,4 +1,6 @@
-// Simple PIO-based (non-DMA) IDE driver code.
+// Simple IDE driver code.  Transfers use bus-master DMA when
+// a PCI IDE controller that can do it is found (the PIIX3 in
+// QEMU), and programmed I/O otherwise.
 
 #include "types.h"
 #include "defs.h"
@@ -23,15 +25,48 @@
 #define IDE_CMD_WRITE 0x30
 #define IDE_CMD_RDMUL 0xc4
 #define IDE_CMD_WRMUL 0xc5
+#define IDE_CMD_SETMUL 0xc6
+#define IDE_CMD_RDDMA 0xc8
+#define IDE_CMD_WRDMA 0xca
 
-// idequeue points to the buf now being read/written to the disk.
-// idequeue->qnext points to the next buf to be processed.
+// Bus-master registers, from the controller's BAR4; the primary
+// channel's are first.
+#define BM_CMD        0     // command
+#define BM_STATUS     2     // status
+#define BM_PRDT       4     // physical address of the PRD table
+#define BM_CMD_START  0x01
+#define BM_CMD_READ   0x08  // device to memory
+#define BM_ST_ERR     0x02
+#define BM_ST_INTR    0x04
+
+#define IDE_MAXDMA    64    // sectors per DMA request
+#define PRD_EOT       0x8000
+
+#define SPB         (BSIZE/SECTOR_SIZE)  // sectors per block
+#define IDE_MAXMULT 16   // sectors per READ/WRITE MULTIPLE interrupt
+
+// Physical Region Descriptor: one piece of a DMA transfer.
+// The table must not cross a 64KB boundary, hence its alignment.
+struct prd {
+  uint addr;
+  ushort len;
+  ushort flags;
+};
+
+// idequeue holds the requests not yet finished.  The first
+// idebusy bufs are the blocks of the command now running on the
+// disk; the rest wait in C-LOOK order: ascending from idepos, the
+// last block started, then wrapping around to the lowest block.
 // You must hold idelock while manipulating queue.
 
 static struct spinlock idelock;
 static struct buf *idequeue;
+static int idebusy;
+static uint idepos;
 
 static int havedisk1;
+static int idedma;      // bus-master I/O base, or 0 for PIO
+static struct prd prdt[IDE_MAXDMA] __attribute__((__aligned__(sizeof(struct prd)*IDE_MAXDMA)));
 static void idestart(struct buf*);
 
 // Wait for IDE disk to become ready.
@@ -47,11 +82,46 @@ idewait(int checkerr)
   return 0;
 }
 
+// Let a READ/WRITE MULTIPLE of up to IDE_MAXMULT sectors
+// interrupt only once.  The command's own interrupt is masked,
+// so that it cannot be taken for the completion of a request.
+static void
+idesetmult(int dev)
+{
+  outb(0x3f6, 2);  // no interrupt
+  outb(0x1f6, 0xe0 | ((dev&1)<<4));
+  outb(0x1f2, IDE_MAXMULT);
+  outb(0x1f7, IDE_CMD_SETMUL);
+  idewait(0);
+}
+
+// Look for a PCI IDE controller that can do bus-master DMA
+// and enable it.
+static void
+idedmainit(void)
+{
+  uint bdf, bar;
+
+  if(pcifind(0x01, 0x01, &bdf) < 0)
+    return;
+  if((pciread(bdf, 0x08) & 0x8000) == 0)  // no bus master
+    return;
+  bar = pciread(bdf, 0x20);
+  if((bar & 1) == 0 || (bar & ~3) == 0)
+    return;
+  pciwrite(bdf, 0x04, (pciread(bdf, 0x04) & 0xffff) | 0x5);  // I/O, bus master
+  idedma = bar & ~3;
+  outb(idedma + BM_CMD, 0);
+  outb(idedma + BM_STATUS, BM_ST_ERR | BM_ST_INTR);
+}
+
 void
 ideinit(void)
 {
   int i;
 
+  if(SPB > IDE_MAXMULT)
+    panic("ideinit: block too large");
   initlock(&idelock, "ide");
   ioapicenable(IRQ_IDE, ncpu - 1);
   idewait(0);
@@ -65,35 +135,105 @@ ideinit(void)
     }
   }
 
+  idesetmult(0);
+  if(havedisk1)
+    idesetmult(1);
+  idedmainit();
+
   // Switch back to disk 0.
   outb(0x1f6, 0xe0 | (0<<4));
 }
 
-// Start the request for b.  Caller must hold idelock.
+// Position of b's block, for ordering the queue.
+static uint
+qpos(struct buf *b)
+{
+  return (b->dev << 24) | b->blockno;
+}
+
+// Insert b among the waiting requests in C-LOOK order.
+// Caller must hold idelock.
+static void
+ideenqueue(struct buf *b)
+{
+  struct buf **pp;
+  uint pos, p;
+  int i, wrap, w;
+
+  pos = qpos(b);
+  wrap = pos < idepos;  // served on the next sweep
+  pp = &idequeue;
+  for(i = 0; i < idebusy; i++)
+    pp = &(*pp)->qnext;
+  for(; *pp; pp = &(*pp)->qnext){
+    p = qpos(*pp);
+    w = p < idepos;
+    if(w > wrap || (w == wrap && p > pos))
+      break;
+  }
+  b->qnext = *pp;
+  *pp = b;
+}
+
+// Start the request for b, merged with the requests queued
+// after it for the blocks that follow, in the same direction.
+// Caller must hold idelock.
 static void
 idestart(struct buf *b)
 {
+  struct buf *e, *q;
+  int i, n, sector, nsect, maxsect, write, read_cmd, write_cmd;
+
   if(b == 0)
     panic("idestart");
   if(b->blockno >= FSSIZE)
     panic("incorrect blockno");
-  int sector_per_block =  BSIZE/SECTOR_SIZE;
-  int sector = b->blockno * sector_per_block;
-  int read_cmd = (sector_per_block == 1) ? IDE_CMD_READ :  IDE_CMD_RDMUL;
-  int write_cmd = (sector_per_block == 1) ? IDE_CMD_WRITE : IDE_CMD_WRMUL;
 
-  if (sector_per_block > 7) panic("idestart");
+  write = (b->flags & B_DIRTY) != 0;
+  maxsect = idedma ? IDE_MAXDMA : IDE_MAXMULT;
+  n = 1;
+  for(e = b; (q = e->qnext) != 0 && (n+1)*SPB <= maxsect; e = q, n++){
+    if(q->dev != b->dev || q->blockno != e->blockno+1 ||
+       ((q->flags & B_DIRTY) != 0) != write)
+      break;
+  }
+  idebusy = n;
+  idepos = qpos(e);
+
+  sector = b->blockno * SPB;
+  nsect = n * SPB;
+  read_cmd = (nsect == 1) ? IDE_CMD_READ :  IDE_CMD_RDMUL;
+  write_cmd = (nsect == 1) ? IDE_CMD_WRITE : IDE_CMD_WRMUL;
+
+  if(idedma){
+    // One PRD per buffer: each buf's data lies within a page.
+    for(i = 0, q = b; i < n; i++, q = q->qnext){
+      prdt[i].addr = V2P(q->data);
+      prdt[i].len = BSIZE;
+      prdt[i].flags = 0;
+    }
+    prdt[n-1].flags = PRD_EOT;
+    read_cmd = IDE_CMD_RDDMA;
+    write_cmd = IDE_CMD_WRDMA;
+    outl(idedma + BM_PRDT, V2P(prdt));
+    outb(idedma + BM_CMD, write ? 0 : BM_CMD_READ);
+    outb(idedma + BM_STATUS, BM_ST_ERR | BM_ST_INTR);
+  }
 
   idewait(0);
   outb(0x3f6, 0);  // generate interrupt
-  outb(0x1f2, sector_per_block);  // number of sectors
+  outb(0x1f2, nsect);  // number of sectors
   outb(0x1f3, sector & 0xff);
   outb(0x1f4, (sector >> 8) & 0xff);
   outb(0x1f5, (sector >> 16) & 0xff);
   outb(0x1f6, 0xe0 | ((b->dev&1)<<4) | ((sector>>24)&0x0f));
-  if(b->flags & B_DIRTY){
+  if(idedma){
+    outb(0x1f7, write ? write_cmd : read_cmd);
+    outb(idedma + BM_CMD, (write ? 0 : BM_CMD_READ) | BM_CMD_START);
+  } else if(write){
     outb(0x1f7, write_cmd);
-    outsl(0x1f0, b->data, BSIZE/4);
+    for(q = b; n-- > 0; q = q->qnext)
+      outsl(0x1f0, q->data, BSIZE/4);
   } else {
     outb(0x1f7, read_cmd);
   }
@@ -104,24 +244,47 @@ void
 ideintr(void)
 {
   struct buf *b;
+  int ok;
 
-  // First queued buffer is the active request.
+  // The first idebusy queued buffers are the active request.
   acquire(&idelock);
 
-  if((b = idequeue) == 0){
+  if(idequeue == 0){
     release(&idelock);
     return;
   }
-  idequeue = b->qnext;
+
+  ok = 1;
+  if(idedma){
+    // The data is already in place; stop the engine.
+    if(inb(idedma + BM_STATUS) & BM_ST_ERR)
+      ok = 0;
+    outb(idedma + BM_CMD, 0);
+    outb(idedma + BM_STATUS, BM_ST_ERR | BM_ST_INTR);
+  }
 
   // Read data if needed.
-  if(!(b->flags & B_DIRTY) && idewait(1) >= 0)
-    insl(0x1f0, b->data, BSIZE/4);
+  if(idewait(1) < 0)
+    ok = 0;
+  for(; idebusy > 0; idebusy--){
+    b = idequeue;
+    idequeue = b->qnext;
+    if(!(b->flags & B_DIRTY) && ok && !idedma)
+      insl(0x1f0, b->data, BSIZE/4);
+    if(!ok)
+      b->flags |= B_ERROR;
+
+    // Wake process waiting for this buf.
+    b->flags |= B_VALID;
+    b->flags &= ~B_DIRTY;
+    wakeup(b);
 
-  // Wake process waiting for this buf.
-  b->flags |= B_VALID;
-  b->flags &= ~B_DIRTY;
-  wakeup(b);
+    // Nobody waits for a read-ahead; release it here.
+    if(b->flags & B_ASYNC){
+      b->flags &= ~B_ASYNC;
+      bdone(b);
+    }
+  }
 
   // Start disk on next buf in queue.
   if(idequeue != 0)
@@ -131,38 +294,69 @@ ideintr(void)
 }
 
 //PAGEBREAK!
-// Sync buf with disk.
+// Queue n bufs, and start the disk if it is idle.
+// Caller must hold idelock.
+static void
+idequeuev(struct buf **bs, int n)
+{
+  struct buf *b;
+  int i;
+
+  for(i = 0; i < n; i++){
+    b = bs[i];
+    if(!holdingsleep(&b->lock))
+      panic("iderw: buf not locked");
+    if((b->flags & (B_VALID|B_DIRTY)) == B_VALID)
+      panic("iderw: nothing to do");
+    if(b->dev != 0 && !havedisk1)
+      panic("iderw: ide disk 1 not present");
+  }
+
+  for(i = 0; i < n; i++){
+    bs[i]->flags &= ~B_ERROR;
+    ideenqueue(bs[i]);
+  }
+
+  // Start disk if necessary.
+  if(idebusy == 0)
+    idestart(idequeue);
+}
+
+// Sync n bufs with disk, queueing them all before waiting, so
+// that adjacent blocks go to the disk as one command.
 // If B_DIRTY is set, write buf to disk, clear B_DIRTY, set B_VALID.
 // Else if B_VALID is not set, read buf from disk, set B_VALID.
 void
-iderw(struct buf *b)
+iderwv(struct buf **bs, int n)
 {
-  struct buf **pp;
-
-  if(!holdingsleep(&b->lock))
-    panic("iderw: buf not locked");
-  if((b->flags & (B_VALID|B_DIRTY)) == B_VALID)
-    panic("iderw: nothing to do");
-  if(b->dev != 0 && !havedisk1)
-    panic("iderw: ide disk 1 not present");
+  int i;
 
   acquire(&idelock);  //DOC:acquire-lock
 
-  // Append b to idequeue.
-  b->qnext = 0;
-  for(pp=&idequeue; *pp; pp=&(*pp)->qnext)  //DOC:insert-queue
-    ;
-  *pp = b;
+  idequeuev(bs, n);
 
-  // Start disk if necessary.
-  if(idequeue == b)
-    idestart(b);
-
-  // Wait for request to finish.
-  while((b->flags & (B_VALID|B_DIRTY)) != B_VALID){
-    sleep(b, &idelock);
+  // Wait for requests to finish.
+  for(i = 0; i < n; i++){
+    while((bs[i]->flags & (B_VALID|B_DIRTY)) != B_VALID){
+      sleep(bs[i], &idelock);
+    }
   }
 
+  release(&idelock);
+}
+
+void
+iderw(struct buf *b)
+{
+  iderwv(&b, 1);
+}
 
+// Start reading n B_ASYNC bufs without waiting for them.
+// ideintr() hands each to bdone() when its data is in.
+void
+iderwasync(struct buf **bs, int n)
+{
+  acquire(&idelock);
+  idequeuev(bs, n);
   release(&idelock);
 }
@@ -8,6 +8,7 @@
 #include "memlayout.h"
 #include "mmu.h"
 #include "spinlock.h"
+#include "page.h"
 
 void freerange(void *vstart, void *vend);
 extern char end[]; // first address after kernel loaded from ELF file
@@ -21,19 +22,47 @@ struct {
   struct spinlock lock;
   int use_lock;
   uint num_free_pages;  //store number of free pages
+  uint num_total_pages; //pages handed to the allocator at boot
   struct run *freelist;
+  struct page *pages;   //one struct page per frame from pagebase to PHYSTOP
+  uint pagebase;        //physical address described by pages[0]
 } kmem;
 
+// Commit accounting.  Every page of user address space is charged
+// when it is created (fork, sbrk, exec, spawn) and uncharged when
+// it goes away, so that requests RAM plus swap cannot back are
+// refused at the system call instead of failing later in kalloc().
+struct {
+  struct spinlock lock;
+  int mode;             // OVERCOMMIT_*
+  uint committed;       // pages currently charged
+} vmcommit;
+
 // Initialization happens in two phases.
 // 1. main() calls kinit1() while still using entrypgdir to place just
 // the pages mapped by entrypgdir on free list.
 // 2. main() calls kinit2() with the rest of the physical pages
 // after installing a full page table that maps them on all cores.
+// kinit1() also carves the struct page array for all of memory up
+// to PHYSTOP out of the start of [vstart, vend).
 void
 kinit1(void *vstart, void *vend)
 {
+  uint n;
+
   initlock(&kmem.lock, "kmem");
+  initlock(&vmcommit.lock, "vmcommit");
+  vmcommit.mode = OVERCOMMIT_GUESS;
   kmem.use_lock = 0;
+
+  kmem.pages = (struct page*)PGROUNDUP((uint)vstart);
+  n = (PHYSTOP - V2P(kmem.pages)) / PGSIZE;
+  vstart = (char*)kmem.pages + PGROUNDUP(n * sizeof(struct page));
+  if((char*)vstart > (char*)vend)
+    panic("kinit1: no room for struct page");
+  memset(kmem.pages, 0, (char*)vstart - (char*)kmem.pages);
+  kmem.pagebase = V2P(vstart);
+
   freerange(vstart, vend);
 }
 
@@ -51,8 +80,10 @@ freerange(void *vstart, void *vend)
   p = (char*)PGROUNDUP((uint)vstart);
   for(; p + PGSIZE <= (char*)vend; p += PGSIZE)
   {
+    pa2page(V2P(p))->refcnt = 1;
     kfree(p);
     kmem.num_free_pages+=1;
+    kmem.num_total_pages+=1;
   }
     
 }
@@ -61,14 +92,36 @@ freerange(void *vstart, void *vend)
 // which normally should have been returned by a
 // call to kalloc().  (The exception is when
 // initializing the allocator; see kinit above.)
+// Pages with more than one user (see kdup) are only returned to
+// the freelist when the last user frees them.
 void
 kfree(char *v)
 {
   struct run *r;
+  struct page *pg;
 
   if((uint)v % PGSIZE || v < end || V2P(v) >= PHYSTOP)
     panic("kfree");
 
+  pg = pa2page(V2P(v));
+  if(kmem.use_lock)
+    acquire(&kmem.lock);
+  if(pg->flags & PG_FREE)
+    panic("kfree: page already free");
+  if(--pg->refcnt > 0){
+    if(kmem.use_lock)
+      release(&kmem.lock);
+    return;
+  }
+  if(kmem.use_lock)
+    release(&kmem.lock);
+  if(pg->flags & PG_LRU)
+    repl_unmap(pg);
+  pg->flags = PG_FREE;
+  pg->pgdir = 0;
+  pg->va = 0;
+  pg->shm = 0;
+
   // Fill with junk to catch dangling refs.
   memset(v, 1, PGSIZE);
 
@@ -82,13 +135,13 @@ kfree(char *v)
     release(&kmem.lock);
 }
 
-// Allocate one 4096-byte page of physical memory.
-// Returns a pointer that the kernel can use.
-// Returns 0 if the memory cannot be allocated.
+// Allocate a page only if one is free, without reclaiming any.
+// For callers that swap_page_out() itself depends on.
 char*
-kalloc(void)
+ktryalloc(void)
 {
   struct run *r;
+  struct page *pg;
 
   if(kmem.use_lock)
     acquire(&kmem.lock);
@@ -97,27 +150,111 @@ kalloc(void)
   {
     kmem.freelist = r->next;
     kmem.num_free_pages-=1;
+    pg = pa2page(V2P(r));
+    pg->flags = 0;
+    pg->refcnt = 1;
   }
-    
   if(kmem.use_lock)
     release(&kmem.lock);
-  
-  if ((char*)r == 0)
-  {
-    // swap_page_out(victim_pte, victim_proc);
-    // return kalloc();
-    // cprintf("inside kalloc when out of memory\n");
-    char* swapped_out_page_addr = swap_page_out();
-    if (swapped_out_page_addr == 0)
-    {
-      panic("kalloc: out of memory");
+  return (char*)r;
+}
+
+// Allocate one 4096-byte page of physical memory.
+// Returns a pointer that the kernel can use.
+// Returns 0 if the memory cannot be allocated.
+char*
+kalloc(void)
+{
+  struct page *pg;
+  char *mem;
+
+  for(;;){
+    if((mem = ktryalloc()) != 0)
+      return mem;
+
+    // Out of physical memory.  Idle buffer cache pages are the
+    // cheapest to take back; otherwise push a page out to swap.
+    if(bshrink())
+      continue;
+    if((mem = swap_page_out(0)) != 0){
+      pg = pa2page(V2P(mem));
+      pg->flags = 0;
+      pg->pgdir = 0;
+      pg->va = 0;
+      return mem;
     }
-    return swapped_out_page_addr;
+
+    // Swap is full as well.  Let the OOM killer free up a
+    // process and try again, or give up.
+    if(oom_kill() == 0)
+      return 0;
   }
+}
+// Take another reference to the page at v, which must already
+// be allocated.  Each reference is dropped with kfree().
+void
+kdup(char *v)
+{
+  struct page *pg;
 
+  pg = pa2page(V2P(v));
+  acquire(&kmem.lock);
+  if(pg->refcnt < 1)
+    panic("kdup");
+  pg->refcnt++;
+  release(&kmem.lock);
+}
 
-  return (char*)r;
+// Take another reference to pg unless it is on its way to the
+// freelist.  Returns 1 if a reference was taken.
+int
+ktrydup(struct page *pg)
+{
+  int ok;
+
+  acquire(&kmem.lock);
+  ok = pg->refcnt > 0 && (pg->flags & PG_FREE) == 0;
+  if(ok)
+    pg->refcnt++;
+  release(&kmem.lock);
+  return ok;
+}
+
+// Convert between a physical address and its struct page.
+struct page*
+pa2page(uint pa)
+{
+  if(pa < kmem.pagebase || pa >= PHYSTOP)
+    panic("pa2page");
+  return &kmem.pages[(pa - kmem.pagebase) / PGSIZE];
 }
+
+uint
+page2pa(struct page *pg)
+{
+  return kmem.pagebase + (pg - kmem.pages) * PGSIZE;
+}
+
+// Return the struct page array and its length in *n.
+struct page*
+framearray(int *n)
+{
+  *n = (PHYSTOP - kmem.pagebase) / PGSIZE;
+  return kmem.pages;
+}
+
+// Can kalloc() return a page without pushing one out to swap?
+int
+kavail(void)
+{
+  int avail;
+
+  acquire(&kmem.lock);
+  avail = kmem.freelist != 0;
+  release(&kmem.lock);
+  return avail;
+}
+
 uint 
 num_of_FreePages(void)
 {
@@ -129,3 +266,51 @@ num_of_FreePages(void)
   
   return num_free_pages;
 }
+
+// Charge npages of user memory against the commit limit.
+// Returns 0 if the charge was taken, -1 if the current overcommit
+// mode refuses it.
+int
+commit_charge(uint npages)
+{
+  uint limit;
+
+  acquire(&vmcommit.lock);
+  limit = kmem.num_total_pages + NSWAP/8;
+  if((vmcommit.mode == OVERCOMMIT_GUESS && npages > limit) ||
+     (vmcommit.mode == OVERCOMMIT_NEVER && vmcommit.committed + npages > limit)){
+    release(&vmcommit.lock);
+    return -1;
+  }
+  vmcommit.committed += npages;
+  release(&vmcommit.lock);
+  return 0;
+}
+
+// Return npages previously taken by commit_charge().
+void
+commit_uncharge(uint npages)
+{
+  acquire(&vmcommit.lock);
+  if(npages > vmcommit.committed)
+    panic("commit_uncharge");
+  vmcommit.committed -= npages;
+  release(&vmcommit.lock);
+}
+
+// Select the overcommit mode.  Returns the previous mode,
+// or -1 if mode is not one of OVERCOMMIT_*.
+int
+setovercommit(int mode)
+{
+  int old;
+
+  if(mode != OVERCOMMIT_GUESS && mode != OVERCOMMIT_ALWAYS &&
+     mode != OVERCOMMIT_NEVER)
+    return -1;
+  acquire(&vmcommit.lock);
+  old = vmcommit.mode;
+  vmcommit.mode = mode;
+  release(&vmcommit.lock);
+  return old;
+}
@@ -113,6 +113,18 @@ lapiceoi(void)
     lapicw(EOI, 0);
 }
 
+// Send interrupt vector to the CPU with local APIC id apicid.
+void
+lapicipi(int apicid, int vector)
+{
+  pushcli();
+  lapicw(ICRHI, apicid<<24);
+  lapicw(ICRLO, FIXED | vector);
+  while(lapic[ICRLO] & DELIVS)
+    ;
+  popcli();
+}
+
 // Spin for a given number of microseconds.
 // On real hardware would want to tune this dynamically.
 void
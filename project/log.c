@@ -20,6 +20,14 @@
 // But if it thinks the log is close to running out, it
 // sleeps until the last outstanding end_op() commits.
 //
+// Commits are grouped: the last outstanding end_op() commits
+// only once the log is half full, and otherwise leaves the
+// transaction open for later system calls to join.  The
+// logcommit kernel process commits an open transaction
+// LOGCOMMITTICKS after its first write, if nothing else has.
+// So a system call's updates may reach the disk a little after
+// it returns, but always atomically and in order.
+//
 // The log is a physical re-do log containing disk blocks.
 // The on-disk log format:
 //   header block, containing block #s for block A, B, C, ...
@@ -29,19 +37,24 @@
 //   ...
 // Log appends are synchronous.
 
+#define LOGBATCH MAXIOBLOCKS  // blocks per disk request when copying the log
+#define LOGMAX   (BSIZE/sizeof(int) - 1)  // most blocks the header can list
+
 // Contents of the header block, used for both the on-disk header block
 // and to keep track in memory of logged block# before commit.
 struct logheader {
   int n;
-  int block[LOGSIZE];
+  int block[LOGMAX];
 };
 
 struct log {
   struct spinlock lock;
   int start;
   int size;
+  int cap;         // most blocks in a transaction
   int outstanding; // how many FS sys calls are executing.
   int committing;  // in commit(), please wait.
+  uint firsttick;  // ticks at the first log_write() of the open transaction
   int dev;
   struct logheader lh;
 };
@@ -49,11 +62,12 @@ struct log log;
 
 static void recover_from_log(void);
 static void commit();
+static void logcommitter(void);
 
 void
 initlog(int dev)
 {
-  if (sizeof(struct logheader) >= BSIZE)
+  if (sizeof(struct logheader) > BSIZE)
     panic("initlog: too big logheader");
 
   struct superblock sb;
@@ -61,23 +75,38 @@ initlog(int dev)
   readsb(dev, &sb);
   log.start = sb.logstart;
   log.size = sb.nlog;
+  log.cap = log.size - 1;
+  if (log.cap > LOGMAX)
+    log.cap = LOGMAX;
+  if (log.cap < MAXOPBLOCKS)
+    panic("initlog: log too small");
   log.dev = dev;
   recover_from_log();
+  if (kproc("logcommit", logcommitter) < 0)
+    panic("initlog: logcommit");
 }
 
 // Copy committed blocks from log to their home location
+// LOGBATCH blocks at a time, so the disk can sort and merge them.
 static void
 install_trans(void)
 {
-  int tail;
-
-  for (tail = 0; tail < log.lh.n; tail++) {
-    struct buf *lbuf = bread(log.dev, log.start+tail+1); // read log block
-    struct buf *dbuf = bread(log.dev, log.lh.block[tail]); // read dst
-    memmove(dbuf->data, lbuf->data, BSIZE);  // copy block to dst
-    bwrite(dbuf);  // write dst to disk
-    brelse(lbuf);
-    brelse(dbuf);
+  struct buf *lbuf[LOGBATCH], *dbuf[LOGBATCH];
+  int tail, i, n;
+
+  for (tail = 0; tail < log.lh.n; tail += n) {
+    n = log.lh.n - tail;
+    if (n > LOGBATCH)
+      n = LOGBATCH;
+    breadv(log.dev, log.start+tail+1, lbuf, n); // read log blocks
+    for (i = 0; i < n; i++) {
+      dbuf[i] = bread(log.dev, log.lh.block[tail+i]); // read dst
+      memmove(dbuf[i]->data, lbuf[i]->data, BSIZE);  // copy block to dst
+      brelse(lbuf[i]);
+    }
+    bwritev(dbuf, n);  // write dsts to disk
+    for (i = 0; i < n; i++)
+      brelse(dbuf[i]);
   }
 }
 
@@ -121,6 +150,42 @@ recover_from_log(void)
   write_head(); // clear the log
 }
 
+// Commit the open transaction.  Caller holds log.lock, and no
+// FS system call is outstanding.
+static void
+docommit(void)
+{
+  log.committing = 1;
+  // call commit w/o holding locks, since not allowed
+  // to sleep with locks.
+  release(&log.lock);
+  commit();
+  acquire(&log.lock);
+  log.committing = 0;
+  wakeup(&log);
+}
+
+// Should the last outstanding end_op() commit now, rather than
+// leave the transaction open?  Caller holds log.lock.
+static int
+commitdue(void)
+{
+  return log.lh.n > 0 &&
+    (log.lh.n * 2 >= log.cap || ticks - log.firsttick >= LOGCOMMITTICKS);
+}
+
+// Most blocks the log may soon hold dirty in the buffer cache:
+// those of the open transaction and those its running system
+// calls may still add.  Read without log.lock, since bshrink()
+// calls it with buffer cache locks held; a stale value moves the
+// cache's floor for a moment at worst, and begin_op() checks it
+// again.
+int
+logblocks(void)
+{
+  return log.lh.n + log.outstanding*MAXOPBLOCKS;
+}
+
 // called at the start of each FS system call.
 void
 begin_op(void)
@@ -129,63 +194,87 @@ begin_op(void)
   while(1){
     if(log.committing){
       sleep(&log, &log.lock);
-    } else if(log.lh.n + (log.outstanding+1)*MAXOPBLOCKS > LOGSIZE){
-      // this op might exhaust log space; wait for commit.
-      sleep(&log, &log.lock);
+    } else if(log.lh.n + (log.outstanding+1)*MAXOPBLOCKS > log.cap){
+      // this op might exhaust log space; wait for commit,
+      // or commit the open transaction if nothing else will.
+      if(log.outstanding == 0)
+        docommit();
+      else
+        sleep(&log, &log.lock);
     } else {
       log.outstanding += 1;
       release(&log.lock);
+      breserve(logblocks());
       break;
     }
   }
 }
 
 // called at the end of each FS system call.
-// commits if this was the last outstanding operation.
+// commits if this was the last outstanding operation
+// and the commit is due.
 void
 end_op(void)
 {
-  int do_commit = 0;
-
   acquire(&log.lock);
   log.outstanding -= 1;
   if(log.committing)
     panic("log.committing");
-  if(log.outstanding == 0){
-    do_commit = 1;
-    log.committing = 1;
+  if(log.outstanding == 0 && commitdue()){
+    docommit();
   } else {
     // begin_op() may be waiting for log space,
     // and decrementing log.outstanding has decreased
     // the amount of reserved space.
     wakeup(&log);
+    if(log.outstanding == 0 && log.lh.n > 0)
+      wakeup(&log.lh);  // start logcommit's timer
   }
   release(&log.lock);
+}
 
-  if(do_commit){
-    // call commit w/o holding locks, since not allowed
-    // to sleep with locks.
-    commit();
-    acquire(&log.lock);
-    log.committing = 0;
-    wakeup(&log);
-    release(&log.lock);
+// Kernel process that commits a transaction left open by
+// end_op() once it is LOGCOMMITTICKS old.
+static void
+logcommitter(void)
+{
+  acquire(&log.lock);
+  for(;;){
+    if(log.lh.n == 0 || log.outstanding > 0 || log.committing){
+      sleep(&log.lh, &log.lock);
+    } else if(!commitdue()){
+      release(&log.lock);
+      acquire(&tickslock);
+      sleep(&ticks, &tickslock);
+      release(&tickslock);
+      acquire(&log.lock);
+    } else {
+      docommit();
+    }
   }
 }
 
 // Copy modified blocks from cache to log.
+// The log blocks are consecutive, so each batch is one disk request.
 static void
 write_log(void)
 {
-  int tail;
-
-  for (tail = 0; tail < log.lh.n; tail++) {
-    struct buf *to = bread(log.dev, log.start+tail+1); // log block
-    struct buf *from = bread(log.dev, log.lh.block[tail]); // cache block
-    memmove(to->data, from->data, BSIZE);
-    bwrite(to);  // write the log
-    brelse(from);
-    brelse(to);
+  struct buf *to[LOGBATCH];
+  int tail, i, n;
+
+  for (tail = 0; tail < log.lh.n; tail += n) {
+    n = log.lh.n - tail;
+    if (n > LOGBATCH)
+      n = LOGBATCH;
+    bgetv(log.dev, log.start+tail+1, to, n); // log blocks, overwritten whole
+    for (i = 0; i < n; i++) {
+      struct buf *from = bread(log.dev, log.lh.block[tail+i]); // cache block
+      memmove(to[i]->data, from->data, BSIZE);
+      brelse(from);
+    }
+    bwritev(to, n);  // write the log
+    for (i = 0; i < n; i++)
+      brelse(to[i]);
   }
 }
 
@@ -215,7 +304,7 @@ log_write(struct buf *b)
 {
   int i;
 
-  if (log.lh.n >= LOGSIZE || log.lh.n >= log.size - 1)
+  if (log.lh.n >= log.cap)
     panic("too big a transaction");
   if (log.outstanding < 1)
     panic("log_write outside of trans");
@@ -226,8 +315,11 @@ log_write(struct buf *b)
       break;
   }
   log.lh.block[i] = b->blockno;
-  if (i == log.lh.n)
+  if (i == log.lh.n) {
+    if (log.lh.n == 0)
+      log.firsttick = ticks;
     log.lh.n++;
+  }
   b->flags |= B_DIRTY; // prevent eviction
   release(&log.lock);
 }
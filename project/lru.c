@@ -0,0 +1,141 @@
+// Two-list LRU replacement policy.
+//
+// Every tracked frame is on one of two lists, threaded through its
+// struct page.  New frames start at the head of the inactive list.
+// The periodic sample, run from the timer interrupt, tests and
+// clears PTE_A in bounded batches: referenced frames near the tail
+// of the inactive list are promoted to the active list, and
+// unreferenced frames at the tail of the active list are demoted
+// while the inactive list is the shorter of the two.  Victims come
+// from the tail of the inactive list, giving any frame referenced
+// since it was last sampled a second chance.
+//
+// Called with the replacement lock held (see replace.c).
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "memlayout.h"
+#include "mmu.h"
+#include "page.h"
+
+static struct {
+  struct page active;     // list heads; head.next is most recent
+  struct page inactive;
+  int nactive;
+  int ninactive;
+} lru;
+
+static void
+lru_del(struct page *pg)
+{
+  plist_del(pg);
+  if(pg->flags & PG_ACTIVE)
+    lru.nactive--;
+  else
+    lru.ninactive--;
+  pg->flags &= ~PG_ACTIVE;
+}
+
+// Insert pg after head, which is a list head or a frame on the
+// inactive list.
+static void
+lru_add(struct page *head, struct page *pg)
+{
+  plist_add(head, pg);
+  if(head == &lru.active){
+    pg->flags |= PG_ACTIVE;
+    lru.nactive++;
+  } else
+    lru.ninactive++;
+}
+
+// Move pg to the head of the list at head.
+static void
+lru_move(struct page *head, struct page *pg)
+{
+  lru_del(pg);
+  lru_add(head, pg);
+}
+
+static void
+lru_init(void)
+{
+  plist_init(&lru.active);
+  plist_init(&lru.inactive);
+  lru.nactive = lru.ninactive = 0;
+}
+
+static void
+lru_map(struct page *pg)
+{
+  lru_add(&lru.inactive, pg);
+}
+
+static void
+lru_unmap(struct page *pg)
+{
+  lru_del(pg);
+}
+
+static void
+lru_sample(void)
+{
+  struct page *pg, *prev;
+  int n;
+
+  // Promote referenced frames from the reclaim end of the
+  // inactive list.
+  pg = lru.inactive.lru_prev;
+  for(n = 0; n < REPL_SAMPLE_BATCH && pg != &lru.inactive; n++){
+    prev = pg->lru_prev;
+    if(replreferenced(pg))
+      lru_move(&lru.active, pg);
+    pg = prev;
+  }
+
+  // Refill the inactive list from the tail of the active list.
+  for(n = 0; n < REPL_SAMPLE_BATCH && lru.ninactive < lru.nactive; n++){
+    pg = lru.active.lru_prev;
+    if(replreferenced(pg))
+      lru_move(&lru.active, pg);
+    else
+      lru_move(&lru.inactive, pg);
+  }
+}
+
+static struct page*
+lru_victim(pde_t *owner)
+{
+  struct page *pg;
+  int scan;
+
+  for(scan = lru.nactive + lru.ninactive; scan > 0; scan--){
+    if(lru.ninactive == 0)
+      lru_move(&lru.inactive, lru.active.lru_prev);
+    pg = lru.inactive.lru_prev;
+    if(replreferenced(pg)){
+      lru_move(&lru.active, pg);
+      continue;
+    }
+    if(!replevictable(pg, owner)){
+      lru_move(&lru.inactive, pg);
+      continue;
+    }
+    return pg;
+  }
+  return 0;
+}
+
+// Move pg to the tail of the inactive list.
+static void
+lru_deactivate(struct page *pg)
+{
+  lru_del(pg);
+  lru_add(lru.inactive.lru_prev, pg);
+}
+
+struct replops lruops = {
+  "lru", lru_init, lru_map, lru_sample, lru_unmap, lru_victim,
+  lru_deactivate,
+};
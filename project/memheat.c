@@ -0,0 +1,68 @@
+// Sample the working set of a process and draw its heat map.
+// usage: memheat pid [ticks [interval]]
+//
+// Each character is one page of the process's address space,
+// 64 pages to a row: '.' is a page not referenced in any sample,
+// '1'-'9' the fraction of samples it was referenced in, tenths
+// rounded up, and '#' a page referenced in every sample.
+
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "wset.h"
+
+uchar counts[WS_MAXPAGES];
+
+int
+main(int argc, char **argv)
+{
+  struct wsstat st;
+  int pid, t, interval, n, i, c, hot, used, hist[11];
+
+  if(argc < 2 || argc > 4){
+    printf(2, "usage: memheat pid [ticks [interval]]\n");
+    exit();
+  }
+  pid = atoi(argv[1]);
+  t = argc > 2 ? atoi(argv[2]) : 100;
+  interval = argc > 3 ? atoi(argv[3]) : 5;
+
+  if(wsctl(pid, interval) < 0){
+    printf(2, "memheat: cannot sample pid %d\n", pid);
+    exit();
+  }
+  sleep(t);
+  n = wsread(&st, counts, sizeof(counts));
+  wsctl(0, 0);
+
+  if(st.samples == 0){
+    printf(1, "memheat: pid %d did not run in %d ticks\n", pid, t);
+    exit();
+  }
+
+  memset(hist, 0, sizeof(hist));
+  used = hot = 0;
+  for(i = 0; i < n; i++){
+    c = counts[i] >= st.samples ? 10 : (counts[i] * 10 + st.samples - 1) / st.samples;
+    hist[c]++;
+    if(counts[i])
+      used++;
+    if(c == 10)
+      hot++;
+    if(i % 64 == 0)
+      printf(1, "%x ", i * 4096);
+    printf(1, "%c", c == 0 ? '.' : c == 10 ? '#' : '0' + c);
+    if(i % 64 == 63 || i == n - 1)
+      printf(1, "\n");
+  }
+
+  printf(1, "pid %d: %d samples every %d ticks, %d pages\n",
+         pid, st.samples, st.interval, n);
+  printf(1, "working set %d pages (%d KB), %d in every sample\n",
+         used, used * 4, hot);
+  printf(1, "tenths:");
+  for(i = 0; i <= 10; i++)
+    printf(1, " %d", hist[i]);
+  printf(1, "\n");
+  exit();
+}
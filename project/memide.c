@@ -58,3 +58,24 @@ iderw(struct buf *b)
     memmove(b->data, p, BSIZE);
   b->flags |= B_VALID;
 }
+
+void
+iderwv(struct buf **bs, int n)
+{
+  int i;
+
+  for(i = 0; i < n; i++)
+    iderw(bs[i]);
+}
+
+void
+iderwasync(struct buf **bs, int n)
+{
+  int i;
+
+  for(i = 0; i < n; i++){
+    iderw(bs[i]);
+    bs[i]->flags &= ~B_ASYNC;
+    bdone(bs[i]);
+  }
+}
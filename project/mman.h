@@ -0,0 +1,16 @@
+// Protection and flags for mmap().
+#define PROT_READ       0x1
+#define PROT_WRITE      0x2
+
+#define MAP_SHARED      0x01  // changes are shared (and written back)
+#define MAP_PRIVATE     0x02  // changes are private to the process
+#define MAP_ANONYMOUS   0x20  // zero-filled, no file
+
+#define MAP_FAILED      ((void*)-1)
+
+// Memory management advice for madvise().
+#define MADV_NORMAL     0  // no special treatment
+#define MADV_RANDOM     1  // no readahead or drop-behind
+#define MADV_SEQUENTIAL 2  // read ahead on faults, drop pages behind
+#define MADV_WILLNEED   3  // swap the range back in now
+#define MADV_DONTNEED   4  // free the range; it reads back as zeros
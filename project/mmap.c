@@ -0,0 +1,427 @@
+// Memory-mapped regions: mmap(), munmap() and msync().
+//
+// Mappings live between MMAPBASE and KERNBASE, above anything
+// sbrk() can reach, and are described by the process's vma[]
+// table.  Nothing is mapped when mmap() returns; each page is
+// faulted in on first touch (mmap_fault), zero-filled or read from
+// the file.  Once resident a mapped page is an ordinary user page:
+// it is tracked by the replacement policy and can be swapped out.
+//
+// MAP_PRIVATE pages belong to the process alone; a private file
+// mapping is copied from the file when faulted in and never
+// written back.  MAP_SHARED pages are shared with children across
+// fork, and dirty pages of a shared file mapping are written back
+// to the file by msync(), munmap() and exit.  fork() faults in
+// every page of a shared mapping before handing it to the child,
+// so that both map the same frames.  A frame is pinned while it is
+// shared, since eviction only updates one PTE, and given back to
+// the replacement policy when only one mapping of it is left.
+//
+// There is no page cache: two processes that map the same file
+// separately each get their own copy of its pages.  Named shared
+// memory (shm.c) is attached into the same area.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "memlayout.h"
+#include "mmu.h"
+#include "x86.h"
+#include "proc.h"
+#include "fs.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "file.h"
+#include "page.h"
+#include "mman.h"
+
+// Return the mapping of p that va lies in, or 0.
+struct vma*
+findvma(struct proc *p, uint va)
+{
+  struct vma *v;
+
+  for(v = p->vma; v < &p->vma[NVMA]; v++)
+    if(v->start && va >= v->start && va < v->end)
+      return v;
+  return 0;
+}
+
+// Find room for len bytes in the mapping area, at addr if that
+// is free, and otherwise at the lowest free address.
+static uint
+findgap(struct proc *p, uint addr, uint len)
+{
+  struct vma *v;
+  uint a;
+  int moved;
+
+  if(addr >= MMAPBASE && addr % PGSIZE == 0 && addr + len > addr &&
+     addr + len <= KERNBASE){
+    for(v = p->vma; v < &p->vma[NVMA]; v++)
+      if(v->start && addr < v->end && addr + len > v->start)
+        break;
+    if(v == &p->vma[NVMA])
+      return addr;
+  }
+
+  a = MMAPBASE;
+  do {
+    moved = 0;
+    for(v = p->vma; v < &p->vma[NVMA]; v++){
+      if(v->start && a < v->end && a + len > v->start){
+        a = v->end;
+        moved = 1;
+      }
+    }
+  } while(moved && a + len > a && a + len <= KERNBASE);
+  if(a + len < a || a + len > KERNBASE)
+    return 0;
+  return a;
+}
+
+// Lowest free address with room for len bytes, or 0.
+uint
+mmap_gap(struct proc *p, uint len)
+{
+  return findgap(p, 0, len);
+}
+
+// Map len bytes of f from offset off (or zeroes, if f is 0) into
+// the current process.  Returns the address, or -1.
+int
+mmap(uint addr, uint len, int prot, int flags, struct file *f, uint off)
+{
+  struct proc *p = myproc();
+  struct vma *v, *nv;
+
+  len = PGROUNDUP(len);
+  if(len == 0 || off % PGSIZE)
+    return -1;
+  if((flags & (MAP_SHARED|MAP_PRIVATE)) == 0 ||
+     (flags & (MAP_SHARED|MAP_PRIVATE)) == (MAP_SHARED|MAP_PRIVATE))
+    return -1;
+  if(flags & MAP_ANONYMOUS)
+    f = 0;
+  else {
+    if(f == 0 || f->type != FD_INODE || !f->readable)
+      return -1;
+    if((flags & MAP_SHARED) && (prot & PROT_WRITE) && !f->writable)
+      return -1;
+  }
+
+  nv = 0;
+  for(v = p->vma; v < &p->vma[NVMA]; v++)
+    if(v->start == 0){
+      nv = v;
+      break;
+    }
+  if(nv == 0 || (addr = findgap(p, addr, len)) == 0)
+    return -1;
+  if(commit_charge(len / PGSIZE) < 0)
+    return -1;
+
+  nv->start = addr;
+  nv->end = addr + len;
+  nv->prot = prot;
+  nv->flags = flags;
+  nv->f = f ? filedup(f) : 0;
+  nv->off = off;
+  nv->seg = 0;
+  return addr;
+}
+
+// Write the page at va of shared file mapping v, whose contents
+// are at mem, back to the file.  Like filewrite(), a few blocks at
+// a time; the file is not extended.
+static void
+writeback(struct vma *v, uint va, char *mem)
+{
+  struct inode *ip = v->f->ip;
+  int max = ((MAXOPBLOCKS-1-1-2) / 2) * 512;
+  uint off, i, n;
+
+  off = v->off + (va - v->start);
+  for(i = 0; i < PGSIZE; i += n){
+    begin_op();
+    ilock(ip);
+    if(off + i >= ip->size){
+      iunlock(ip);
+      end_op();
+      break;
+    }
+    n = PGSIZE - i;
+    if(n > max)
+      n = max;
+    if(n > ip->size - off - i)
+      n = ip->size - off - i;
+    writei(ip, mem + i, off + i, n);
+    iunlock(ip);
+    end_op();
+  }
+}
+
+// Write back the dirty pages of v in [start, end), and if drop is
+// set unmap them as well.
+static void
+flush(struct proc *p, struct vma *v, uint start, uint end, int drop)
+{
+  pte_t *pte;
+  char *mem;
+  uint a;
+
+  for(a = start; a < end; a += PGSIZE){
+    if((pte = walkpgdir(p->pgdir, (char*)a, 0)) == 0){
+      a = PGADDR(PDX(a) + 1, 0, 0) - PGSIZE;
+      continue;
+    }
+    if(v->f && (v->flags & MAP_SHARED)){
+      if((*pte & PTE_P) && (*pte & PTE_D)){
+        // Keep the frame while writei() sleeps.
+        mem = P2V(PTE_ADDR(*pte));
+        kdup(mem);
+        *pte &= ~PTE_D;
+        writeback(v, a, mem);
+        kfree(mem);
+      } else if(!(*pte & PTE_P) && (*pte & 0x008) && (mem = kalloc()) != 0){
+        if(swap_read(*pte, mem) & PTE_D)
+          writeback(v, a, mem);
+        kfree(mem);
+      }
+    }
+    if(drop){
+      if(*pte & PTE_P){
+        mem = P2V(PTE_ADDR(*pte));
+        *pte = 0;
+        if(v->flags & MAP_SHARED)
+          unpinshared(V2P(mem), a);
+        kfree(mem);
+        p->rss -= PGSIZE;
+      } else if(*pte & 0x008){
+        freepage(pte);
+        p->swapsz -= PGSIZE;
+      }
+      *pte = 0;
+    }
+  }
+  if(p == myproc())
+    lcr3(V2P(p->pgdir));
+}
+
+// Remove [addr, addr+len) from the current process's mappings.
+// A mapping may be trimmed at either end or split in two.
+int
+munmap(uint addr, uint len)
+{
+  struct proc *p = myproc();
+  struct vma *v, *nv;
+  uint end, lo, hi;
+
+  len = PGROUNDUP(len);
+  end = addr + len;
+  if(addr % PGSIZE || end < addr)
+    return -1;
+
+  for(v = p->vma; v < &p->vma[NVMA]; v++){
+    if(v->start == 0 || addr >= v->end || end <= v->start)
+      continue;
+    lo = addr > v->start ? addr : v->start;
+    hi = end < v->end ? end : v->end;
+    if(v->seg){
+      // Shared memory segments go all at once.
+      if(lo != v->start || hi != v->end)
+        return -1;
+      shm_detach(p, v);
+      continue;
+    }
+    if(lo > v->start && hi < v->end){
+      // Punching a hole: the upper part needs a slot of its own.
+      for(nv = p->vma; nv < &p->vma[NVMA]; nv++)
+        if(nv->start == 0)
+          break;
+      if(nv == &p->vma[NVMA])
+        return -1;
+      *nv = *v;
+      nv->start = hi;
+      nv->off += hi - v->start;
+      if(nv->f)
+        filedup(nv->f);
+      v->end = hi;
+    }
+    flush(p, v, lo, hi, 1);
+    commit_uncharge((hi - lo) / PGSIZE);
+    if(lo == v->start && hi == v->end){
+      if(v->f)
+        fileclose(v->f);
+      v->start = v->end = 0;
+      v->f = 0;
+    } else if(lo == v->start){
+      v->off += hi - v->start;
+      v->start = hi;
+    } else
+      v->end = lo;
+  }
+  return 0;
+}
+
+// Write back the dirty shared pages in [addr, addr+len).
+int
+msync(uint addr, uint len)
+{
+  struct proc *p = myproc();
+  struct vma *v;
+  uint end, lo, hi;
+
+  end = addr + PGROUNDUP(len);
+  if(addr % PGSIZE || end < addr)
+    return -1;
+  for(v = p->vma; v < &p->vma[NVMA]; v++){
+    if(v->start == 0 || addr >= v->end || end <= v->start)
+      continue;
+    lo = addr > v->start ? addr : v->start;
+    hi = end < v->end ? end : v->end;
+    flush(p, v, lo, hi, 0);
+  }
+  return 0;
+}
+
+// Fault in the page at va, if it belongs to a mapping of p.
+// Returns -1 if it does not or there is no memory for it.
+int
+mmap_fault(struct proc *p, uint va)
+{
+  struct vma *v;
+  char *mem;
+  int perm;
+
+  if((v = findvma(p, va)) == 0)
+    return -1;
+  if(v->seg)
+    return shm_fault(p, v, va);
+  va = PGROUNDDOWN(va);
+  if((mem = kalloc()) == 0)
+    return -1;
+  memset(mem, 0, PGSIZE);
+  if(v->f){
+    ilock(v->f->ip);
+    readi(v->f->ip, mem, v->off + (va - v->start), PGSIZE);
+    iunlock(v->f->ip);
+  }
+  perm = PTE_U;
+  if(v->prot & PROT_WRITE)
+    perm |= PTE_W;
+  if(mappage(p->pgdir, va, mem, perm) < 0){
+    kfree(mem);
+    return -1;
+  }
+  p->rss += PGSIZE;
+  rss_trim(p);
+  return 0;
+}
+
+// Bring the page at va of p into memory and pin it.  Returns
+// its PTE, or 0 if the page was never touched.  Sets *err on
+// failure.
+static pte_t*
+pinpage(struct proc *p, uint va, int *err)
+{
+  pte_t *pte;
+
+  for(;;){
+    pte = walkpgdir(p->pgdir, (char*)va, 0);
+    if(pte == 0 || *pte == 0)
+      return 0;
+    if(*pte & PTE_P){
+      if(repl_pin(pa2page(PTE_ADDR(*pte))))
+        return pte;
+      yield();    // being swapped out; look again when it is
+    } else if(swap_page_in(pte, p, va) < 0){
+      *err = 1;
+      return 0;
+    }
+  }
+}
+
+// Give child np copies of p's mappings: private pages are copied,
+// shared pages are faulted in if need be and mapped in both.
+int
+mmap_fork(struct proc *p, struct proc *np)
+{
+  struct vma *v, *nv;
+  pte_t *pte;
+  char *mem;
+  uint a;
+  int err;
+
+  for(v = p->vma, nv = np->vma; v < &p->vma[NVMA]; v++, nv++){
+    if(v->start == 0)
+      continue;
+    if(v->seg){
+      if(shm_fork(v, np->pgdir) < 0)
+        return -1;
+      *nv = *v;
+      continue;
+    }
+    if(commit_charge((v->end - v->start) / PGSIZE) < 0)
+      return -1;
+    *nv = *v;
+    if(nv->f)
+      filedup(nv->f);
+
+    err = 0;
+    for(a = v->start; a < v->end; a += PGSIZE){
+      if(v->flags & MAP_SHARED){
+        while((pte = pinpage(p, a, &err)) == 0)
+          if(err || mmap_fault(p, a) < 0)
+            return -1;
+        mem = P2V(PTE_ADDR(*pte));
+        kdup(mem);
+        if(mappage(np->pgdir, a, mem, PTE_FLAGS(*pte) & ~PTE_P) < 0){
+          kfree(mem);
+          return -1;
+        }
+      } else {
+        if((mem = kalloc()) == 0)
+          return -1;
+        pte = walkpgdir(p->pgdir, (char*)a, 0);
+        if(pte == 0 || *pte == 0){
+          kfree(mem);
+          continue;
+        }
+        if(*pte & PTE_P)
+          memmove(mem, P2V(PTE_ADDR(*pte)), PGSIZE);
+        else
+          swap_read(*pte, mem);
+        if(mappage(np->pgdir, a, mem, PTE_U | (v->prot & PROT_WRITE ? PTE_W : 0)) < 0){
+          kfree(mem);
+          return -1;
+        }
+      }
+      np->rss += PGSIZE;
+    }
+  }
+  return 0;
+}
+
+// Remove all of p's mappings, writing back dirty shared pages.
+// Called by exit and exec before the address space goes away.
+void
+mmap_exit(struct proc *p)
+{
+  struct vma *v;
+
+  for(v = p->vma; v < &p->vma[NVMA]; v++){
+    if(v->start == 0)
+      continue;
+    if(v->seg){
+      shm_detach(p, v);
+      continue;
+    }
+    flush(p, v, v->start, v->end, 1);
+    commit_uncharge((v->end - v->start) / PGSIZE);
+    if(v->f)
+      fileclose(v->f);
+    v->start = v->end = 0;
+    v->f = 0;
+  }
+}
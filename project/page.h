@@ -0,0 +1,33 @@
+// Per-frame metadata.  kinit1() allocates one struct page for
+// every physical page between the end of the kernel and PHYSTOP,
+// so bookkeeping about a frame can be found in constant time with
+// pa2page() instead of by scanning page tables.
+struct page {
+  uint flags;           // PG_* below
+  int refcnt;           // Number of users; 0 while on the freelist
+  pde_t *pgdir;         // User page table mapping this frame, if any
+  uint va;              // User virtual address it is mapped at
+  struct page *lru_next; // Replacement policy list (see replace.c)
+  struct page *lru_prev;
+  struct shmseg *shm;   // Segment owning the frame, if PG_SHM
+  uint shmidx;          // and its page number there
+};
+
+#define PG_FREE    0x1  // on the kmem freelist
+#define PG_LRU     0x2  // tracked by the replacement policy
+#define PG_ACTIVE  0x4  // on the active LRU list (lru.c)
+#define PG_REPLREF 0x8  // PTE_A seen by wset.c, not yet by the policy
+#define PG_WSREF   0x10 // PTE_A seen by the policy, not yet by wset.c
+#define PG_PINNED  0x20 // mlock()ed: kept off the policy's lists
+#define PG_SHM     0x40 // belongs to a shared memory segment (shm.c)
+
+// Page replacement policy operations (see replace.c).
+struct replops {
+  char *name;
+  void (*init)(void);
+  void (*on_map)(struct page*);
+  void (*on_access_sample)(void);
+  void (*on_unmap)(struct page*);
+  struct page *(*pick_victim)(pde_t*);
+  void (*deactivate)(struct page*);
+};
@@ -9,6 +9,8 @@
 #include "sleeplock.h"
 #include "fs.h"
 #include "buf.h"
+#include "page.h"
+#include "mman.h"
 
 
 
@@ -19,10 +21,11 @@ struct swap_slot {
 };
 
 struct swap_slot swap_table[(NSWAP/8)];
+struct spinlock swaplock;   // protects is_free in swap_table
 
 void swap_init() {
 
-
+    initlock(&swaplock, "swap");
     for (int i = 0; i < (NSWAP/8); i++) {
         swap_table[i].is_free = 1;
         swap_table[i].page_perm = 0;
@@ -31,103 +34,205 @@ void swap_init() {
     }
 }
 
-// modified to free the page and also return the freed page
-char* swap_page_out() {
-    // cprintf("\ninside swap_page_out\n");
-    struct proc *victim_proc = find_victim_process();
-    pte_t* victim_pte = find_victim_pte(victim_proc);
-    // if (victim_pte == 0)
-    // {
-    //     panic("victim_pte is null");     
-    // }
-
-    // cprintf("victim_proc pid: %x and rss: %d\n", victim_proc->pid, victim_proc->rss);
-    // cprintf("*victim_pte: %x\n", *victim_pte);
-    struct buf *b;
-    char *mem_page;
+// Claim a free swap slot.  Returns its index, or -1 if swap is full.
+static int swap_alloc(void)
+{
     int i;
 
-    // Find a free swap slot
+    acquire(&swaplock);
     for (i = 0; i < (NSWAP/8); i++) {
         if (swap_table[i].is_free) {
             swap_table[i].is_free = 0;
-            swap_table[i].page_perm = PTE_FLAGS(*victim_pte);
             break;
         }
     }
+    release(&swaplock);
+    return i < (NSWAP/8) ? i : -1;
+}
 
-    // If no free swap slot is found, return -1
-    if (i == (NSWAP/8)) {
-        panic("swap_page_out: no free swap slot found\n");
-        return 0;
-    }
-
-    // Write the page to the swap slot
-    mem_page = (char*)P2V(PTE_ADDR(*victim_pte));
+static void swap_free(int i)
+{
+    acquire(&swaplock);
+    swap_table[i].is_free = 1;
+    release(&swaplock);
+}
 
-    // cprintf("mem_page: %x\n", mem_page);
+// Copy the page at mem into the slot buffers bs, locked by
+// swap_page_out(), write them as one disk request and release
+// them.  Returns -1 if the disk failed the write.
+static int swap_write(struct buf **bs, char *mem)
+{
+    int j, r;
 
-    uint j;
+    for (j = 0; j < 8; j++)
+        memmove(bs[j]->data, mem + j * BSIZE, BSIZE);
+    bwritev(bs, 8);
+    r = 0;
     for (j = 0; j < 8; j++) {
-        b = bread(ROOTDEV, swap_table[i].starting_block_number + j);
-        memmove(b->data, mem_page + j * BSIZE, BSIZE);
-        bwrite(b);
-        brelse(b);
+        if (bs[j]->flags & B_ERROR)
+            r = -1;
+        brelse(bs[j]);
     }
+    return r;
+}
 
-    // Update the page table entry
-    victim_proc->rss -= PGSIZE;
+// modified to free the page and also return the freed page
+// returns 0 if there is nothing to evict or swap is full
+// the victim frame is chosen by the replacement policy (replace.c),
+// from the pages of owner only if owner is not 0
+char* swap_page_out(pde_t *owner) {
+    struct page *pg;
+    struct proc *victim_proc;
+    pte_t *victim_pte;
+    pde_t *pgdir;
+    struct buf *bs[8];
+    char *mem_page;
+    int i, j, pid;
+    uint e;
+
+again:
+    // repl_victim() takes a reference for us, held across the
+    // disk writes, which sleep, in case the owner unmaps the page
+    // or exits meanwhile.
+    if ((pg = repl_victim(owner)) == 0)
+        return 0;
+    mem_page = (char*)P2V(page2pa(pg));
 
-    // *victim_pte = (*victim_pte & ~0xFFF) | i;
-    *victim_pte = (i << 12);
+    // If no free swap slot is found, return 0 and let kalloc()
+    // fall back to the OOM killer.
+    if ((i = swap_alloc()) < 0) {
+        repl_map(pg);
+        kfree(mem_page);
+        return 0;
+    }
+    e = (i << 12) | 0x008;
+
+    // Lock the slot's buffers first.  Until swap_write() releases
+    // them, a fault on the swap entry waits for them in bread()
+    // instead of reading the slot's old contents.  The old
+    // contents are overwritten whole, so they are not read in.
+    bgetv(ROOTDEV, swap_table[i].starting_block_number, bs, 8);
+
+    if (pg->flags & PG_SHM) {
+        // The segment unmaps every attachment before the copy, for
+        // the same reason as below.
+        if (shm_evict(pg, e) == 0) {
+            for (j = 0; j < 8; j++)
+                brelse(bs[j]);
+            swap_free(i);
+            return mem_page;
+        }
+        if (swap_write(bs, mem_page) < 0 && shm_unevict(pg, e)) {
+            swap_free(i);
+            return 0;
+        }
+        return mem_page;
+    }
 
-    // *victim_pte &= ~PTE_P;
-    *victim_pte |= 0x008;
-    // cprintf("in swap out --> swap slot: %x, swap_table[i].page_perm %x\n", i, swap_table[i].page_perm);
-    
-    // cprintf("after swapping out victim: *pte =%x\n", *victim_pte); 
-    // cprintf("Exiting swap_page_out\n\n");
+    // Replace the mapping by the swap entry before the page is
+    // copied, and flush it from every TLB, so that no write to the
+    // page is lost: a write from now on faults and waits for the
+    // copy.  Hold ptable.lock while using the owner's page table,
+    // so that exit() or exec() cannot free it under us.
+    victim_proc = lockpgdir(pg->pgdir);
+    victim_pte = victim_proc ? walkpgdir(victim_proc->pgdir, (void*)pg->va, 0) : 0;
+    if (victim_pte == 0 || (*victim_pte & PTE_P) == 0 ||
+        PTE_ADDR(*victim_pte) != V2P(mem_page)) {
+        // The mapping went away meanwhile, or is not visible yet
+        // (e.g. fork still building the page table).  Give the
+        // frame back rather than guess; if ours was the last
+        // reference it is now free for the taking.
+        if (victim_proc)
+            unlockpgdir();
+        for (j = 0; j < 8; j++)
+            brelse(bs[j]);
+        swap_free(i);
+        repl_map(pg);
+        kfree(mem_page);
+        if ((mem_page = ktryalloc()) != 0)
+            return mem_page;
+        goto again;
+    }
+    swap_table[i].page_perm = PTE_FLAGS(*victim_pte);
+    victim_proc->rss -= PGSIZE;
+    victim_proc->swapsz += PGSIZE;
+    *victim_pte = e;
+    pgdir = victim_proc->pgdir;
+    pid = victim_proc->pid;
+    unlockpgdir();
+    tlbflush(pgdir);
+
+    if (swap_write(bs, mem_page) < 0) {
+        // Map the page again, unless its owner has moved on, and
+        // let kalloc() fall back as if swap were full.
+        victim_proc = lockpgdir(pgdir);
+        victim_pte = victim_proc && victim_proc->pid == pid ?
+            walkpgdir(pgdir, (void*)pg->va, 0) : 0;
+        if (victim_pte && *victim_pte == e) {
+            *victim_pte = V2P(mem_page) | swap_table[i].page_perm;
+            victim_proc->rss += PGSIZE;
+            victim_proc->swapsz -= PGSIZE;
+            unlockpgdir();
+            swap_free(i);
+            repl_map(pg);
+            kfree(mem_page);    // ours; the mapping keeps its own
+            return 0;
+        }
+        if (victim_proc)
+            unlockpgdir();
+    }
+
+    // Drop the mapping's reference; the caller gets ours.
+    kfree(mem_page);
     return mem_page;
 }
 
-int swap_page_in(pte_t *page_table_entry, struct proc *p)
+int swap_page_in(pte_t *page_table_entry, struct proc *p, uint va)
 {
     // cprintf("inside swap_page_in\n");
     // cprintf("p->pid: %x, p->pgdir: %x, p->rss: %d\n", p->pid, p->pgdir, p->rss);
     // cprintf("*page_table_entry: %x\n", *page_table_entry);
-    struct buf *b;
     char *mem_page;
     int i;
 
     // Get the swap slot index from the page table entry
     i = *page_table_entry >> 12;
 
-    // Allocate a new page in memory
+    // Allocate a new page in memory.  A process at its RSS limit
+    // recycles one of its own pages; if it has none to give up,
+    // fall back to the global allocator.
     // cprintf("Calling kalloc inside swap_page_in\n");
-    mem_page = kalloc();
+    mem_page = 0;
+    if (p->rsslimit && p->rss >= p->rsslimit &&
+        (mem_page = swap_page_out(p->pgdir)) != 0)
+        pa2page(V2P(mem_page))->flags = 0;
+    if (mem_page == 0)
+        mem_page = kalloc();
     // cprintf("kalloc done, mem_page: %x\n", mem_page);
     if (mem_page == 0) {
         return -1; // Not enough memory
     }
 
     // Read the page from the swap slot
-    for (int j = 0; j < 8; j++) {
-        b = bread(1, swap_table[i].starting_block_number + j);
-        memmove(mem_page + j * BSIZE, b->data, BSIZE);
-        brelse(b);
-    }
+    swap_read(*page_table_entry, mem_page);
 
     // cprintf("in swap in --> swap slot: %x, swap_table[i].page_perm %x\n", i, swap_table[i].page_perm);
 
 
     *page_table_entry = V2P(mem_page) | PTE_P | swap_table[i].page_perm;
     *page_table_entry &= ~0x008;
+    pa2page(V2P(mem_page))->pgdir = p->pgdir;
+    pa2page(V2P(mem_page))->va = PGROUNDDOWN(va);
+    repl_map(pa2page(V2P(mem_page)));
+    repl_fault();
+    p->majflt++;
     // *page_table_entry =V2P(mem_page)  | PTE_P | swap_table[i].page_perm;
     
     p->rss += PGSIZE;
+    p->swapsz -= PGSIZE;
 
     // Free the swap slot
-    swap_table[i].is_free = 1;
+    swap_free(i);
 
 
     // cprintf("after swapping in: *pte =%x\n", *page_table_entry);
@@ -137,6 +242,54 @@ int swap_page_in(pte_t *page_table_entry, struct proc *p)
 
 
 
+// Copy the swapped-out page that pte refers to into mem, leaving
+// the swap slot as it is.  Returns the page's PTE permissions.
+int swap_read(pte_t pte, char *mem)
+{
+    struct buf *bs[8];
+    int i, j;
+
+    i = pte >> 12;
+    breadv(ROOTDEV, swap_table[i].starting_block_number, bs, 8);
+    for (j = 0; j < 8; j++) {
+        memmove(mem + j * BSIZE, bs[j]->data, BSIZE);
+        brelse(bs[j]);
+    }
+    return swap_table[i].page_perm;
+}
+
+// Swap in the swapped-out pages among the n pages from va in p,
+// for as long as that needs neither eviction nor going over p's
+// RSS limit.  Used for MADV_WILLNEED and readahead.
+void swap_prefetch(struct proc *p, uint va, uint n)
+{
+    pte_t *pte;
+
+    for (va = PGROUNDDOWN(va); n > 0 && va < p->sz; n--, va += PGSIZE) {
+        pte = walkpgdir(p->pgdir, (void*)va, 0);
+        if (pte == 0 || (*pte & PTE_P) || (*pte & 0x008) == 0)
+            continue;
+        if (!kavail() || (p->rsslimit && p->rss >= p->rsslimit))
+            break;
+        if (swap_page_in(pte, p, va) < 0)
+            break;
+    }
+}
+
+// Push p's own pages out to swap until it is back within its
+// RSS limit, e.g. after it grew or exec'd.  Stops early if p has
+// nothing evictable or swap is full.
+void rss_trim(struct proc *p)
+{
+    char *mem_page;
+
+    while (p->rsslimit && p->rss > p->rsslimit) {
+        if ((mem_page = swap_page_out(p->pgdir)) == 0)
+            break;
+        kfree(mem_page);
+    }
+}
+
 void page_fault_handler(void)
 {
     // cprintf("inside page_fault_handler\n");
@@ -145,18 +298,67 @@ void page_fault_handler(void)
     // cprintf("va: %x\n", va);
 
     pte_t *pte = walkpgdir(p->pgdir, (void *)va, 0);
+    uint a, lo;
 
-    // if (!pte) {
-    //     // cprintf("page_fault_handler: pte is null\n");
-    //     panic("page_fault_handler");
-    //     return;
-    // }
+    if (pte != 0 && (*pte & PTE_P) && (*pte & PTE_COW)) {
+        // Write to a page loaned to a pipe.
+        if (cowfault(va) < 0) {
+            cprintf("pid %d %s: no memory for page fault--kill proc\n", p->pid, p->name);
+            p->killed = 1;
+        }
+        return;
+    }
+
+    if (va >= MMAPBASE && va < KERNBASE && (pte == 0 || *pte == 0)) {
+        // First touch of an mmap()ed page.
+        if (mmap_fault(p, va) < 0) {
+            cprintf("pid %d %s: page fault at 0x%x--kill proc\n", p->pid, p->name, va);
+            p->killed = 1;
+        }
+        return;
+    }
+
+    if (va < p->sz && pte != 0 && *pte == 0) {
+        // Dropped by madvise(MADV_DONTNEED): map a zeroed page.
+        if (allocuvm(p->pgdir, PGROUNDDOWN(va), PGROUNDDOWN(va) + PGSIZE) == 0) {
+            cprintf("pid %d %s: no memory for page fault--kill proc\n", p->pid, p->name);
+            p->killed = 1;
+            return;
+        }
+        p->rss += PGSIZE;
+        rss_trim(p);
+        return;
+    }
+
+    if (pte == 0 || (*pte & PTE_P) || (*pte & 0x008) == 0) {
+        // Not a swapped-out page: a genuine bad access.
+        cprintf("pid %d %s: page fault at 0x%x--kill proc\n", p->pid, p->name, va);
+        p->killed = 1;
+        return;
+    }
 
     // cprintf("\ncalling swap_page_in\n");
-    if (swap_page_in(pte, p) < 0) {
-        // cprintf("page_fault_handler: swap_page_in failed\n");
+    if (swap_page_in(pte, p, va) < 0) {
+        // Out of memory even after the OOM killer ran.
+        cprintf("pid %d %s: no memory for page fault--kill proc\n", p->pid, p->name);
+        p->killed = 1;
         return;
     }
+
+    // In a MADV_SEQUENTIAL range, read the next pages ahead and
+    // make the pages just behind the fault the next to be evicted.
+    if (p->advice == MADV_SEQUENTIAL && va >= p->advstart && va < p->advend) {
+        va = PGROUNDDOWN(va);
+        swap_prefetch(p, va + PGSIZE, SWAP_READAHEAD);
+        lo = p->advstart;
+        if (va - lo > (SWAP_READAHEAD+1)*PGSIZE)
+            lo = va - (SWAP_READAHEAD+1)*PGSIZE;
+        for (a = lo; a < va; a += PGSIZE) {
+            pte = walkpgdir(p->pgdir, (void *)a, 0);
+            if (pte && (*pte & PTE_P) && (*pte & PTE_U))
+                repl_deactivate(pa2page(PTE_ADDR(*pte)));
+        }
+    }
 }
 
 void freepage(pte_t* pte)
@@ -164,5 +366,5 @@ void freepage(pte_t* pte)
     int slot_no = *pte >> 12;
     // cprintf("inside freepage\n");
 
-    swap_table[slot_no].is_free = 1;
+    swap_free(slot_no);
 }
@@ -7,9 +7,35 @@
 #define NDEV         10  // maximum major device number
 #define ROOTDEV       1  // device number of file system root disk
 #define MAXARG       32  // max exec arguments
+#define MAXARGSTR   128  // longest string argument in mmap()ed memory, with the NUL
 #define MAXOPBLOCKS  10  // max # of blocks any FS op writes
-#define LOGSIZE      (MAXOPBLOCKS*3)  // max data blocks in on-disk log
-#define NBUF         (MAXOPBLOCKS*3)  // size of disk block cache
+#define LOGSIZE      (MAXOPBLOCKS*9)  // blocks in the on-disk log made by mkfs
+#define MAXIOBLOCKS  16  // most blocks in one breadv() or breadahead()
+#define NBUF         (MAXIOBLOCKS*2)  // fewest buffers in the disk block cache, besides the log's
+#define LOGCOMMITTICKS 3  // longest a finished FS op waits to be committed
+#define READAHEAD    16  // most blocks read ahead of a sequential reader
+#define BCACHE_FRAC    32  // buffer cache grows to 1/BCACHE_FRAC of physical memory
 #define SWAPBLOCKS   (400 * 8)  // number of swap blocks
-#define FSSIZE       3500  // size of file system in blocks
+#define FSSIZE       3560  // size of file system in blocks
 #define NSWAP        2400  // maximum number of swap blocks
+#define REPLPOLICY      2  // page replacement policy at boot (REPL_* in replace.h)
+#define REPL_SAMPLE_TICKS 10  // ticks between PTE_A sampling passes
+#define REPL_SAMPLE_BATCH 32  // frames sampled per list per pass
+#define NVMA             8  // mmap() regions per process
+#define NSHM             8  // shared memory segments
+#define SHMNAME         16  // longest segment name, with the NUL
+#define SHMMAXPAGES     64  // largest segment, in pages
+#define NSHMATTACH       8  // attachments per segment
+#define MLOCK_LIMIT     64  // pages a process may mlock()
+#define PIPEMAXPAGES    16  // largest pipe buffer, in pages
+#define SWAP_READAHEAD   4  // pages read ahead in MADV_SEQUENTIAL ranges
+#define THRASH_TICKS    50  // ticks between load-control checks
+#define THRASH_HIGH     64  // major faults per check that mean thrashing
+#define THRASH_LOW      16  // major faults per check low enough to readmit
+#define THRASH_MAXHOLD 500  // longest a process stays suspended (ticks)
+#define OOM_ADJ_MIN (-1000)  // oom_adj value that exempts a process from the OOM killer
+#define OOM_ADJ_MAX  1000  // oom_adj value that makes a process the first OOM victim
+#define OOM_WAIT_TICKS  10  // longest kalloc() waits for an OOM victim to exit
+#define OVERCOMMIT_GUESS   0  // refuse only requests larger than RAM plus swap
+#define OVERCOMMIT_ALWAYS  1  // never refuse; failures surface in the fault path
+#define OVERCOMMIT_NEVER   2  // strict: total commit may not exceed RAM plus swap
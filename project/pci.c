@@ -0,0 +1,54 @@
+// PCI configuration space, through configuration mechanism #1.
+// Just enough to find a device by class and turn it on.
+// A device is named by its configuration address: bus<<16 |
+// device<<11 | function<<8.
+
+#include "types.h"
+#include "defs.h"
+#include "x86.h"
+
+#define PCI_CONFADDR  0xcf8
+#define PCI_CONFDATA  0xcfc
+
+uint
+pciread(uint bdf, int off)
+{
+  outl(PCI_CONFADDR, 0x80000000 | bdf | (off & 0xfc));
+  return inl(PCI_CONFDATA);
+}
+
+void
+pciwrite(uint bdf, int off, uint v)
+{
+  outl(PCI_CONFADDR, 0x80000000 | bdf | (off & 0xfc));
+  outl(PCI_CONFDATA, v);
+}
+
+// Find the first function on bus 0 of the given class and
+// subclass.  Returns 0 and sets *bdf, or -1 if there is none.
+int
+pcifind(int class, int subclass, uint *bdf)
+{
+  uint dev, fn, a, id, cls;
+
+  for(dev = 0; dev < 32; dev++){
+    for(fn = 0; fn < 8; fn++){
+      a = (dev << 11) | (fn << 8);
+      id = pciread(a, 0x00);
+      if((id & 0xffff) == 0xffff){
+        if(fn == 0)
+          break;
+        continue;
+      }
+      cls = pciread(a, 0x08);
+      if((cls >> 24) == class && ((cls >> 16) & 0xff) == subclass){
+        *bdf = a;
+        return 0;
+      }
+      // Only multi-function devices have functions past 0.
+      if(fn == 0 && (pciread(a, 0x0c) & 0x00800000) == 0)
+        break;
+    }
+  }
+  return -1;
+}
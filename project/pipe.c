@@ -7,16 +7,49 @@
 #include "spinlock.h"
 #include "sleeplock.h"
 #include "file.h"
+#include "poll.h"
 
-#define PIPESIZE 512
+#define PIPEBUFS 16
+#define BOUNCESZ (PGSIZE/2)
 
+// Besides the bytes in the ring, a pipe carries whole pages: user
+// pages loaned by pipewrite() (see uvmloan) and pages queued by
+// splice().  A page is read once the bytes written to the ring
+// before it have been read, i.e. when nread reaches at.
+struct pipebuf {
+  char *page;
+  uint off;       // next byte to read
+  uint len;       // end of the data
+  uint at;        // nwrite when the page was queued
+};
+
+// The ring is made of size/PGSIZE pages, a power of two so that
+// positions stay right when nread and nwrite wrap around.
+// Sleepers say so in readwait, writewait and bufwait, so that
+// only crossing a threshold costs a wakeup: readers are woken
+// when a write completes or fills the ring, writers once half
+// the ring is free again.  polled is set when poll() found the
+// pipe not ready; any change then wakes the pollers.
+// bounce stages copies to and from user memory, which are made
+// without p->lock: writers use its first half, readers the second,
+// one at a time each (see bounceget).
 struct pipe {
   struct spinlock lock;
-  char data[PIPESIZE];
+  char *data[PIPEMAXPAGES];
+  char *bounce;
+  uint size;      // ring size in bytes
   uint nread;     // number of bytes read
   uint nwrite;    // number of bytes written
   int readopen;   // read fd is still open
   int writeopen;  // write fd is still open
+  int readwait;   // a reader sleeps for data
+  int writewait;  // a writer sleeps for room in the ring
+  int bufwait;    // a writer sleeps for room in buf[]
+  int polled;     // a poller waits for a change
+  int bouncebusy; // halves of bounce in use, see bounceget
+  struct pipebuf buf[PIPEBUFS];
+  uint bufr;      // number of pages read
+  uint bufw;      // number of pages queued
 };
 
 int
@@ -30,10 +63,12 @@ pipealloc(struct file **f0, struct file **f1)
     goto bad;
   if((p = (struct pipe*)kalloc()) == 0)
     goto bad;
+  memset(p, 0, sizeof(*p));
+  if((p->data[0] = kalloc()) == 0 || (p->bounce = kalloc()) == 0)
+    goto bad;
+  p->size = PGSIZE;
   p->readopen = 1;
   p->writeopen = 1;
-  p->nwrite = 0;
-  p->nread = 0;
   initlock(&p->lock, "pipe");
   (*f0)->type = FD_PIPE;
   (*f0)->readable = 1;
@@ -47,8 +82,11 @@ pipealloc(struct file **f0, struct file **f1)
 
 //PAGEBREAK: 20
  bad:
-  if(p)
+  if(p){
+    if(p->data[0])
+      kfree(p->data[0]);
     kfree((char*)p);
+  }
   if(*f0)
     fileclose(*f0);
   if(*f1)
@@ -56,66 +94,465 @@ pipealloc(struct file **f0, struct file **f1)
   return -1;
 }
 
+// Wake pollers if p has changed.  Called with p->lock held.
+static void
+pipenotify(struct pipe *p)
+{
+  if(p->polled){
+    p->polled = 0;
+    pollwakeup();
+  }
+}
+
 void
 pipeclose(struct pipe *p, int writable)
 {
+  uint i;
+
   acquire(&p->lock);
+  pipenotify(p);
   if(writable){
     p->writeopen = 0;
     wakeup(&p->nread);
   } else {
     p->readopen = 0;
     wakeup(&p->nwrite);
+    wakeup(&p->bufw);
   }
   if(p->readopen == 0 && p->writeopen == 0){
     release(&p->lock);
+    for(; p->bufr != p->bufw; p->bufr++)
+      kfree(p->buf[p->bufr % PIPEBUFS].page);
+    for(i = 0; i < p->size / PGSIZE; i++)
+      kfree(p->data[i]);
+    kfree(p->bounce);
     kfree((char*)p);
   } else
     release(&p->lock);
 }
 
+// Copy n bytes between addr and the ring of p, starting at ring
+// position pos: into the ring if in is set, out of it otherwise.
+// The copy is split where the ring's pages end.
+static void
+ringcopy(struct pipe *p, uint pos, char *addr, uint n, int in)
+{
+  uint i, m, o;
+  char *r;
+
+  for(i = 0; i < n; i += m){
+    o = (pos + i) % p->size;
+    m = PGSIZE - o % PGSIZE;
+    if(m > n - i)
+      m = n - i;
+    r = p->data[o / PGSIZE] + o % PGSIZE;
+    if(in)
+      memmove(r, addr + i, m);
+    else
+      memmove(addr + i, r, m);
+  }
+}
+
+static void
+wakereaders(struct pipe *p)
+{
+  if(p->readwait){
+    p->readwait = 0;
+    wakeup(&p->nread);
+  }
+}
+
+// Wake writers waiting for room if at least half the ring is free.
+static void
+wakewriters(struct pipe *p)
+{
+  if(p->writewait && p->nwrite - p->nread <= p->size / 2){
+    p->writewait = 0;
+    wakeup(&p->nwrite);
+  }
+}
+
+// A page was taken out of buf[].
+static void
+wakebufwriters(struct pipe *p)
+{
+  if(p->bufwait){
+    p->bufwait = 0;
+    wakeup(&p->bufw);
+  }
+}
+
+// Wait until p has room for another page.
+// Called with p->lock held; returns -1 if the reader is gone.
+static int
+pipewaitbuf(struct pipe *p)
+{
+  while(p->bufw == p->bufr + PIPEBUFS){
+    if(p->readopen == 0 || myproc()->killed)
+      return -1;
+    wakereaders(p);
+    p->bufwait = 1;
+    sleep(&p->bufw, &p->lock);
+  }
+  return p->readopen ? 0 : -1;
+}
+
+// Queue len bytes at mem+off, in a page the pipe takes over.
+// Called with p->lock held and room in buf[].
+static void
+pipequeue(struct pipe *p, char *mem, uint off, uint len)
+{
+  struct pipebuf *b;
+
+  b = &p->buf[p->bufw++ % PIPEBUFS];
+  b->page = mem;
+  b->off = off;
+  b->len = off + len;
+  b->at = p->nwrite;
+}
+
+// Take the writers' half of p->bounce if w is set, else the
+// readers', waiting while another writer or reader has it.
+// Called with p->lock held, which may be released meanwhile.
+static char*
+bounceget(struct pipe *p, int w)
+{
+  int bit;
+
+  bit = w ? 1 : 2;
+  while(p->bouncebusy & bit)
+    sleep(&p->bouncebusy, &p->lock);
+  p->bouncebusy |= bit;
+  return p->bounce + (w ? 0 : BOUNCESZ);
+}
+
+static void
+bounceput(struct pipe *p, int w)
+{
+  p->bouncebusy &= ~(w ? 1 : 2);
+  wakeup(&p->bouncebusy);
+}
+
 //PAGEBREAK: 40
+// User memory is never touched with p->lock held, since a fault on
+// it may sleep (swap-in, copy-on-write, first touch of a mapping).
+// Whole pages are loaned; other bytes go through p->bounce, up to
+// BOUNCESZ at a time.
 int
-pipewrite(struct pipe *p, char *addr, int n)
+pipewrite(struct pipe *p, char *addr, int n, int nonblock)
 {
-  int i;
+  int i, m, o;
+  char *mem, *bounce;
 
   acquire(&p->lock);
-  for(i = 0; i < n; i++){
-    while(p->nwrite == p->nread + PIPESIZE){  //DOC: pipewrite-full
+  for(i = 0; i < n; i += m){
+    // Whole pages are loaned to the pipe rather than copied.
+    if(n - i >= PGSIZE && (uint)(addr + i) % PGSIZE == 0 &&
+       (!nonblock || p->bufw != p->bufr + PIPEBUFS)){
+      if(pipewaitbuf(p) < 0){
+        release(&p->lock);
+        return -1;
+      }
+      if((mem = uvmloan((uint)(addr + i))) != 0){
+        pipequeue(p, mem, 0, PGSIZE);
+        m = PGSIZE;
+        continue;
+      }
+    }
+    while(p->nwrite == p->nread + p->size){  //DOC: pipewrite-full
       if(p->readopen == 0 || myproc()->killed){
         release(&p->lock);
         return -1;
       }
-      wakeup(&p->nread);
+      if(nonblock)
+        goto out;
+      wakereaders(p);
+      pipenotify(p);
+      p->writewait = 1;
       sleep(&p->nwrite, &p->lock);  //DOC: pipewrite-sleep
     }
-    p->data[p->nwrite++ % PIPESIZE] = addr[i];
+    m = n - i;
+    if(m > BOUNCESZ)
+      m = BOUNCESZ;
+    // Stop at a page boundary of addr if a whole page follows,
+    // so that it can be loaned.
+    o = PGSIZE - (uint)(addr + i) % PGSIZE;
+    if(o < PGSIZE && n - i >= o + PGSIZE && m > o)
+      m = o;
+    bounce = bounceget(p, 1);
+    release(&p->lock);
+    memmove(bounce, addr + i, m);
+    acquire(&p->lock);
+    // Another writer may have filled the ring meanwhile.
+    if(m > p->size - (p->nwrite - p->nread))
+      m = p->size - (p->nwrite - p->nread);
+    ringcopy(p, p->nwrite, bounce, m, 1);
+    p->nwrite += m;
+    bounceput(p, 1);
   }
-  wakeup(&p->nread);  //DOC: pipewrite-wakeup1
+out:
+  wakereaders(p);  //DOC: pipewrite-wakeup1
+  pipenotify(p);
   release(&p->lock);
-  return n;
+  return i > 0 || n == 0 ? i : -1;
+}
+
+// Is the next data in p a page?  Called with p->lock held.
+static struct pipebuf*
+pipehead(struct pipe *p)
+{
+  struct pipebuf *b;
+
+  if(p->bufr == p->bufw)
+    return 0;
+  b = &p->buf[p->bufr % PIPEBUFS];
+  return b->at == p->nread ? b : 0;
+}
+
+// Number of bytes in the ring that can be read before the next
+// page.  Called with p->lock held.
+static uint
+ringavail(struct pipe *p)
+{
+  if(p->bufr != p->bufw)
+    return p->buf[p->bufr % PIPEBUFS].at - p->nread;
+  return p->nwrite - p->nread;
 }
 
+// Wait for data in p.  Called with p->lock held; returns -1 if
+// killed or if p is empty and nonblock is set, or 0 with either
+// data or the writer gone.
+static int
+pipewaitdata(struct pipe *p, int nonblock)
+{
+  while(p->nread == p->nwrite && p->bufr == p->bufw && p->writeopen){  //DOC: pipe-empty
+    if(myproc()->killed || nonblock)
+      return -1;
+    p->readwait = 1;
+    sleep(&p->nread, &p->lock); //DOC: piperead-sleep
+  }
+  return 0;
+}
+
+// Like pipewrite(), copies bytes out of the ring through p->bounce.
 int
-piperead(struct pipe *p, char *addr, int n)
+piperead(struct pipe *p, char *addr, int n, int nonblock)
 {
-  int i;
+  int i, m;
+  struct pipebuf *b;
+  char *page, *src, *bounce;
 
   acquire(&p->lock);
-  while(p->nread == p->nwrite && p->writeopen){  //DOC: pipe-empty
-    if(myproc()->killed){
+  if(pipewaitdata(p, nonblock) < 0){
+    release(&p->lock);
+    return -1;
+  }
+  for(i = 0; i < n; i += m){  //DOC: piperead-copy
+    if((b = pipehead(p)) != 0){
+      // Copy out without p->lock, since a fault on user memory
+      // may sleep; our reference keeps the page.
+      m = b->len - b->off;
+      if(m > n - i)
+        m = n - i;
+      page = b->page;
+      src = page + b->off;
+      b->off += m;
+      if(b->off == b->len){
+        p->bufr++;         // we get the pipe's reference
+        wakebufwriters(p);
+      } else
+        kdup(page);
       release(&p->lock);
-      return -1;
+      memmove(addr + i, src, m);
+      kfree(page);
+      acquire(&p->lock);
+      continue;
     }
-    sleep(&p->nread, &p->lock); //DOC: piperead-sleep
+    if(ringavail(p) == 0){
+      // Another reader may have taken the data while we waited
+      // for bounce; that is not end of file.
+      if(i > 0 || !p->writeopen)
+        break;
+      if(pipewaitdata(p, nonblock) < 0){
+        i = -1;
+        break;
+      }
+      m = 0;
+      continue;
+    }
+    bounce = bounceget(p, 0);
+    if(pipehead(p) != 0 || (m = ringavail(p)) == 0){
+      bounceput(p, 0);  // look again, p may have changed
+      m = 0;
+      continue;
+    }
+    if(m > n - i)
+      m = n - i;
+    if(m > BOUNCESZ)
+      m = BOUNCESZ;
+    ringcopy(p, p->nread, bounce, m, 0);
+    p->nread += m;
+    release(&p->lock);
+    memmove(addr + i, bounce, m);
+    acquire(&p->lock);
+    bounceput(p, 0);
   }
-  for(i = 0; i < n; i++){  //DOC: piperead-copy
-    if(p->nread == p->nwrite)
-      break;
-    addr[i] = p->data[p->nread++ % PIPESIZE];
+  wakewriters(p);  //DOC: piperead-wakeup
+  pipenotify(p);
+  release(&p->lock);
+  return i;
+}
+
+// Queue the len bytes at mem+off in p, for splice().  The pipe
+// takes over the caller's reference to the page mem unless this
+// returns -1 because the reader is gone.
+int
+pipeputpage(struct pipe *p, char *mem, uint off, int len)
+{
+  acquire(&p->lock);
+  if(pipewaitbuf(p) < 0){
+    release(&p->lock);
+    return -1;
   }
-  wakeup(&p->nwrite);  //DOC: piperead-wakeup
+  pipequeue(p, mem, off, len);
+  wakereaders(p);
+  pipenotify(p);
+  release(&p->lock);
+  return 0;
+}
+
+// Take up to n bytes out of p, for splice().  If the next data is
+// in a page, the caller gets a reference to that page; otherwise
+// the bytes are copied into spare.  *page and *off say where the
+// data is.  Returns the number of bytes, 0 at end of file or, if
+// block is 0, when p is empty, and -1 if killed.
+int
+pipegetpage(struct pipe *p, char *spare, int n, char **page, uint *off,
+            int block)
+{
+  int i;
+  struct pipebuf *b;
+
+  acquire(&p->lock);
+  if(!block && p->nread == p->nwrite && p->bufr == p->bufw){
+    release(&p->lock);
+    return 0;
+  }
+  if(pipewaitdata(p, 0) < 0){
+    release(&p->lock);
+    return -1;
+  }
+  if((b = pipehead(p)) != 0){
+    i = b->len - b->off;
+    if(i > n)
+      i = n;
+    *page = b->page;
+    *off = b->off;
+    b->off += i;
+    if(b->off == b->len){
+      p->bufr++;         // the caller gets the pipe's reference
+      wakebufwriters(p);
+    } else
+      kdup(b->page);
+  } else {
+    i = ringavail(p);
+    if(i > n)
+      i = n;
+    if(i > PGSIZE)
+      i = PGSIZE;
+    ringcopy(p, p->nread, spare, i, 0);
+    p->nread += i;
+    *page = spare;
+    *off = 0;
+  }
+  wakewriters(p);
+  pipenotify(p);
   release(&p->lock);
   return i;
 }
+
+// Resize the ring of p to hold at least n bytes, rounded up to a
+// power-of-two number of pages.  Fails if the data in the ring
+// does not fit.  Returns the new size.
+int
+pipesetsize(struct pipe *p, int n)
+{
+  char *data[PIPEMAXPAGES], *t;
+  uint pos, m, npages, oldpages, i;
+
+  if(n < 0)
+    return -1;
+  for(npages = 1; npages * PGSIZE < n; npages *= 2)
+    if(npages == PIPEMAXPAGES)
+      return -1;
+  for(i = 0; i < npages; i++){
+    if((data[i] = kalloc()) == 0){
+      while(i > 0)
+        kfree(data[--i]);
+      return -1;
+    }
+  }
+
+  acquire(&p->lock);
+  if(p->nwrite - p->nread > npages * PGSIZE){
+    release(&p->lock);
+    for(i = 0; i < npages; i++)
+      kfree(data[i]);
+    return -1;
+  }
+  // Old and new positions agree modulo PGSIZE, so each chunk
+  // lies within one page of both rings.
+  for(pos = p->nread; pos != p->nwrite; pos += m){
+    m = PGSIZE - pos % PGSIZE;
+    if(m > p->nwrite - pos)
+      m = p->nwrite - pos;
+    memmove(data[pos % (npages * PGSIZE) / PGSIZE] + pos % PGSIZE,
+            p->data[pos % p->size / PGSIZE] + pos % PGSIZE, m);
+  }
+  oldpages = p->size / PGSIZE;
+  for(i = 0; i < PIPEMAXPAGES; i++){
+    t = p->data[i];
+    p->data[i] = i < npages ? data[i] : 0;
+    data[i] = t;
+  }
+  p->size = npages * PGSIZE;
+  wakewriters(p);
+  pipenotify(p);
+  release(&p->lock);
+
+  for(i = 0; i < oldpages; i++)
+    kfree(data[i]);
+  return p->size;
+}
+
+int
+pipegetsize(struct pipe *p)
+{
+  return p->size;
+}
+
+// Poll events ready on the read end of p, or on the write end if
+// writeend is set.  Marks p as polled if none is.
+int
+pipepoll(struct pipe *p, int writeend, int events)
+{
+  int r;
+
+  r = 0;
+  acquire(&p->lock);
+  if(writeend){
+    if(p->readopen == 0)
+      r |= POLLERR;
+    else if(p->nwrite - p->nread < p->size)
+      r |= events & POLLOUT;
+  } else {
+    if(p->nread != p->nwrite || p->bufr != p->bufw)
+      r |= events & POLLIN;
+    if(p->writeopen == 0)
+      r |= POLLHUP;
+  }
+  if(r == 0)
+    p->polled = 1;
+  release(&p->lock);
+  return r;
+}
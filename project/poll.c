@@ -0,0 +1,108 @@
+// poll(): wait until one of several file descriptors is ready.
+//
+// Pollers sleep on a single wait queue, pollq.  An object that can
+// make a poller ready (a pipe, the console) sets a flag when a
+// poller finds it not ready; when its state next changes it clears
+// the flag and calls pollwakeup(), and the pollers scan their
+// descriptors again.  pollq.seq counts wakeups, so one that comes
+// between a scan and the sleep is not lost.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "mmu.h"
+#include "proc.h"
+#include "spinlock.h"
+#include "poll.h"
+
+struct {
+  struct spinlock lock;
+  uint seq;       // number of wakeups
+  int ntimed;     // sleepers with a timeout
+} pollq;
+
+void
+pollinit(void)
+{
+  initlock(&pollq.lock, "pollq");
+}
+
+void
+pollwakeup(void)
+{
+  acquire(&pollq.lock);
+  pollq.seq++;
+  wakeup(&pollq);
+  release(&pollq.lock);
+}
+
+// Called from the timer interrupt, so that pollers with a timeout
+// get to check it.
+void
+polltick(void)
+{
+  acquire(&pollq.lock);
+  if(pollq.ntimed > 0){
+    pollq.seq++;
+    wakeup(&pollq);
+  }
+  release(&pollq.lock);
+}
+
+// Wait until at least one of the n descriptors in fds is ready for
+// the events it asks for, or for timeout ticks (forever if timeout
+// is negative).  Sets revents in each and returns the number of
+// descriptors with revents set.
+int
+poll(struct pollfd *fds, int n, int timeout)
+{
+  struct proc *p = myproc();
+  struct pollfd *pfd;
+  struct file *f;
+  uint seq, ticks0;
+  int ready;
+
+  acquire(&tickslock);
+  ticks0 = ticks;
+  release(&tickslock);
+  for(;;){
+    acquire(&pollq.lock);
+    seq = pollq.seq;
+    release(&pollq.lock);
+
+    ready = 0;
+    for(pfd = fds; pfd < fds + n; pfd++){
+      pfd->revents = 0;
+      if(pfd->fd < 0)
+        continue;
+      if(pfd->fd >= NOFILE || (f = p->ofile[pfd->fd]) == 0)
+        pfd->revents = POLLNVAL;
+      else
+        pfd->revents = filepoll(f, pfd->events);
+      if(pfd->revents)
+        ready++;
+    }
+    if(ready || timeout == 0)
+      return ready;
+    if(p->killed)
+      return -1;
+    if(timeout > 0){
+      acquire(&tickslock);
+      if(ticks - ticks0 >= timeout){
+        release(&tickslock);
+        return 0;
+      }
+      release(&tickslock);
+    }
+
+    acquire(&pollq.lock);
+    if(pollq.seq == seq){
+      if(timeout > 0)
+        pollq.ntimed++;
+      sleep(&pollq, &pollq.lock);
+      if(timeout > 0)
+        pollq.ntimed--;
+    }
+    release(&pollq.lock);
+  }
+}
@@ -0,0 +1,11 @@
+struct pollfd {
+  int fd;
+  short events;   // events to wait for
+  short revents;  // events that are ready
+};
+
+#define POLLIN   0x001  // data to read, or end of file
+#define POLLOUT  0x004  // writing will not block
+#define POLLERR  0x008  // pipe with no reader left
+#define POLLHUP  0x010  // pipe with no writer left
+#define POLLNVAL 0x020  // fd is not open
@@ -3,13 +3,7 @@
 #include "user.h"
 
 static void
-putc(int fd, char c)
-{
-  write(fd, &c, 1);
-}
-
-static void
-printint(int fd, int xx, int base, int sgn)
+printint(FILE *f, int xx, int base, int sgn)
 {
   static char digits[] = "0123456789ABCDEF";
   char buf[16];
@@ -32,33 +26,31 @@ printint(int fd, int xx, int base, int sgn)
     buf[i++] = '-';
 
   while(--i >= 0)
-    putc(fd, buf[i]);
+    fputc(buf[i], f);
 }
 
-// Print to the given fd. Only understands %d, %x, %p, %s.
-void
-printf(int fd, const char *fmt, ...)
+// Print to f. Only understands %d, %x, %p, %s.
+static void
+vprintf(FILE *f, const char *fmt, uint *ap)
 {
   char *s;
   int c, i, state;
-  uint *ap;
 
   state = 0;
-  ap = (uint*)(void*)&fmt + 1;
   for(i = 0; fmt[i]; i++){
     c = fmt[i] & 0xff;
     if(state == 0){
       if(c == '%'){
         state = '%';
       } else {
-        putc(fd, c);
+        fputc(c, f);
       }
     } else if(state == '%'){
       if(c == 'd'){
-        printint(fd, *ap, 10, 1);
+        printint(f, *ap, 10, 1);
         ap++;
       } else if(c == 'x' || c == 'p'){
-        printint(fd, *ap, 16, 0);
+        printint(f, *ap, 16, 0);
         ap++;
       } else if(c == 's'){
         s = (char*)*ap;
@@ -66,20 +58,52 @@ printf(int fd, const char *fmt, ...)
         if(s == 0)
           s = "(null)";
         while(*s != 0){
-          putc(fd, *s);
+          fputc(*s, f);
           s++;
         }
       } else if(c == 'c'){
-        putc(fd, *ap);
+        fputc(*ap, f);
         ap++;
       } else if(c == '%'){
-        putc(fd, c);
+        fputc(c, f);
       } else {
         // Unknown % sequence.  Print it to draw attention.
-        putc(fd, '%');
-        putc(fd, c);
+        fputc('%', f);
+        fputc(c, f);
       }
       state = 0;
     }
   }
 }
+
+// Print to the stream f, or to fd if f is 0.  Output that would
+// not be buffered is collected here and written at once.
+static void
+fdprintf(int fd, FILE *f, const char *fmt, uint *ap)
+{
+  FILE tmp;
+  char buf[128];
+
+  if(f == 0 || f->mode == _IONBF){
+    memset(&tmp, 0, sizeof(tmp));
+    tmp.fd = f ? f->fd : fd;
+    setvbuf(&tmp, buf, _IOFBF, sizeof(buf));
+    vprintf(&tmp, fmt, ap);
+    fflush(&tmp);
+  } else
+    vprintf(f, fmt, ap);
+}
+
+// Print to the given fd: through the stream of fd 1 (see stdio.c),
+// or with one write per call for other fds.
+void
+printf(int fd, const char *fmt, ...)
+{
+  fdprintf(fd, fd == 1 ? fdopen(1) : 0, fmt, (uint*)(void*)&fmt + 1);
+}
+
+void
+fprintf(FILE *f, const char *fmt, ...)
+{
+  fdprintf(-1, f, fmt, (uint*)(void*)&fmt + 1);
+}
@@ -6,6 +6,8 @@
 #include "x86.h"
 #include "proc.h"
 #include "spinlock.h"
+#include "mman.h"
+#include "page.h"
 
 struct {
   struct spinlock lock;
@@ -89,6 +91,14 @@ found:
   p->state = EMBRYO;
   p->pid = nextpid++;
   p->rss = PGSIZE;
+  p->starttick = ticks;
+  p->oom_adj = 0;
+  p->rsslimit = 0;
+  p->advice = MADV_NORMAL;
+  memset(p->vma, 0, sizeof(p->vma));
+  p->majflt = p->pffsnap = p->pff = 0;
+  p->suspended = 0;
+  p->kernel = 0;
 
   release(&ptable.lock);
 
@@ -130,6 +140,7 @@ userinit(void)
   if((p->pgdir = setupkvm()) == 0)
     panic("userinit: out of memory?");
   inituvm(p->pgdir, _binary_initcode_start, (int)_binary_initcode_size);
+  commit_charge(1);
   p->sz = PGSIZE;
   memset(p->tf, 0, sizeof(*p->tf));
   p->tf->cs = (SEG_UCODE << 3) | DPL_USER;
@@ -159,18 +170,42 @@ userinit(void)
 int
 growproc(int n)
 {
-  uint sz;
+  uint sz, oldsz, newsz, next, rss, swapsz;
   struct proc *curproc = myproc();
 
-  sz = curproc->sz;
+  sz = oldsz = curproc->sz;
   if(n > 0){
-    if((sz = allocuvm(curproc->pgdir, sz, sz + n)) == 0)
+    if(sz + n < sz || sz + n > MMAPBASE)
       return -1;
+    if(commit_charge((PGROUNDUP(sz + n) - PGROUNDUP(sz)) / PGSIZE) < 0)
+      return -1;
+    // Under an RSS limit, grow a page at a time and trim as we
+    // go, so that the new pages replace the process's own.
+    for(newsz = sz + n; sz < newsz; sz = next){
+      next = curproc->rsslimit ? PGROUNDUP(sz + 1) : newsz;
+      if(next > newsz)
+        next = newsz;
+      if(allocuvm(curproc->pgdir, sz, next) == 0){
+        countuvm(curproc->pgdir, oldsz, sz, &rss, &swapsz);
+        deallocuvm(curproc->pgdir, sz, oldsz);
+        curproc->rss -= rss;
+        curproc->swapsz -= swapsz;
+        curproc->sz = oldsz;
+        commit_uncharge((PGROUNDUP(oldsz + n) - PGROUNDUP(oldsz)) / PGSIZE);
+        return -1;
+      }
+      curproc->rss += PGROUNDUP(next) - PGROUNDUP(sz);
+      curproc->sz = next;
+      rss_trim(curproc);
+    }
   } else if(n < 0){
+    countuvm(curproc->pgdir, sz + n, sz, &rss, &swapsz);
     if((sz = deallocuvm(curproc->pgdir, sz, sz + n)) == 0)
       return -1;
+    curproc->rss -= rss;
+    curproc->swapsz -= swapsz;
+    commit_uncharge((PGROUNDUP(curproc->sz) - PGROUNDUP(sz)) / PGSIZE);
   }
-  curproc->rss += n;
   curproc->sz = sz;
   switchuvm(curproc);
   return 0;
@@ -191,8 +226,18 @@ fork(void)
     return -1;
   }
 
+  // Charge the child's copy of the address space up front, so
+  // that fork fails here rather than in a later page fault.
+  if(commit_charge(PGROUNDUP(curproc->sz) / PGSIZE) < 0){
+    kfree(np->kstack);
+    np->kstack = 0;
+    np->state = UNUSED;
+    return -1;
+  }
+
   // Copy process state from proc.
   if((np->pgdir = copyuvm(curproc->pgdir, curproc->sz)) == 0){
+    commit_uncharge(PGROUNDUP(curproc->sz) / PGSIZE);
     kfree(np->kstack);
     np->kstack = 0;
     np->state = UNUSED;
@@ -201,7 +246,21 @@ fork(void)
   np->sz = curproc->sz;
   np->parent = curproc;
   *np->tf = *curproc->tf;
-  np->rss = curproc->rss;
+  countuvm(np->pgdir, 0, np->sz, &np->rss, &np->swapsz);
+  np->oom_adj = curproc->oom_adj;
+  np->rsslimit = curproc->rsslimit;
+  np->advice = curproc->advice;
+  np->advstart = curproc->advstart;
+  np->advend = curproc->advend;
+  if(mmap_fork(curproc, np) < 0){
+    mmap_exit(np);
+    freevm(setpgdir(np, 0));
+    commit_uncharge(PGROUNDUP(curproc->sz) / PGSIZE);
+    kfree(np->kstack);
+    np->kstack = 0;
+    np->state = UNUSED;
+    return -1;
+  }
 
   // Clear %eax so that fork returns 0 in the child.
   np->tf->eax = 0;
@@ -224,9 +283,89 @@ fork(void)
   return pid;
 }
 
+// Create a new process running the program at path, without
+// copying the caller's address space first.  The child's image is
+// built directly by loadimage(), so the cost does not depend on
+// the size of the parent.  If fdmap is 0 the child inherits all
+// open files; otherwise child fd i is a dup of the parent's fd
+// fdmap[i], or closed if fdmap[i] < 0.
+// Returns the child's pid, or -1 on failure.
+int
+spawn(char *path, char **argv, int *fdmap)
+{
+  int i, pid;
+  uint eip, sp;
+  struct proc *np;
+  struct proc *curproc = myproc();
+
+  if(fdmap){
+    for(i = 0; i < NOFILE; i++)
+      if(fdmap[i] >= NOFILE || (fdmap[i] >= 0 && curproc->ofile[fdmap[i]] == 0))
+        return -1;
+  }
+
+  // Allocate process.
+  if((np = allocproc()) == 0){
+    return -1;
+  }
+
+  if(loadimage(path, argv, &np->pgdir, &np->sz, &eip, &sp) < 0){
+    kfree(np->kstack);
+    np->kstack = 0;
+    np->state = UNUSED;
+    return -1;
+  }
+  if(commit_charge(np->sz / PGSIZE) < 0){
+    freevm(setpgdir(np, 0));
+    kfree(np->kstack);
+    np->kstack = 0;
+    np->state = UNUSED;
+    return -1;
+  }
+  np->parent = curproc;
+  np->rss = np->sz;
+  np->swapsz = 0;
+  np->oom_adj = curproc->oom_adj;
+  np->rsslimit = curproc->rsslimit;
+
+  memset(np->tf, 0, sizeof(*np->tf));
+  np->tf->cs = (SEG_UCODE << 3) | DPL_USER;
+  np->tf->ds = (SEG_UDATA << 3) | DPL_USER;
+  np->tf->es = np->tf->ds;
+  np->tf->ss = np->tf->ds;
+  np->tf->eflags = FL_IF;
+  np->tf->esp = sp;
+  np->tf->eip = eip;
+
+  for(i = 0; i < NOFILE; i++){
+    if(fdmap == 0){
+      if(curproc->ofile[i])
+        np->ofile[i] = filedup(curproc->ofile[i]);
+    } else if(fdmap[i] >= 0)
+      np->ofile[i] = filedup(curproc->ofile[fdmap[i]]);
+  }
+  np->cwd = idup(curproc->cwd);
+
+  safestrcpy(np->name, execname(path), sizeof(np->name));
+
+  // As in exec, start within the inherited RSS limit.
+  rss_trim(np);
+
+  pid = np->pid;
+
+  acquire(&ptable.lock);
+
+  np->state = RUNNABLE;
+
+  release(&ptable.lock);
+
+  return pid;
+}
+
 // Exit the current process.  Does not return.
 // An exited process remains in the zombie state
 // until its parent calls wait() to find out it exited.
+// Only the proc slot is kept; its memory is freed here.
 void
 exit(void)
 {
@@ -237,6 +376,9 @@ exit(void)
   if(curproc == initproc)
     panic("init exiting");
 
+  // Write back and drop mmap() regions.
+  mmap_exit(curproc);
+
   // Close all open files.
   for(fd = 0; fd < NOFILE; fd++){
     if(curproc->ofile[fd]){
@@ -252,6 +394,20 @@ exit(void)
 
   acquire(&ptable.lock);
 
+  // Release the address space and swap slots now rather than in
+  // wait(), so that a slow parent does not keep a dead child's
+  // memory pinned.  Holding ptable.lock keeps us from being
+  // rescheduled onto the page table we are about to free.  The
+  // kernel stack is still in use; scheduler() frees it once we
+  // have switched off it.
+  switchkvm();
+  freevm(curproc->pgdir);
+  commit_uncharge(PGROUNDUP(curproc->sz) / PGSIZE);
+  curproc->pgdir = 0;
+  curproc->sz = 0;
+  curproc->rss = 0;
+  curproc->swapsz = 0;
+
   // Parent might be sleeping in wait().
   wakeup1(curproc->parent);
 
@@ -288,12 +444,9 @@ wait(void)
         continue;
       havekids = 1;
       if(p->state == ZOMBIE){
-        // Found one.
-        clear_swap(p->pgdir, p);
+        // Found one.  Its memory was already freed by exit()
+        // and scheduler().
         pid = p->pid;
-        kfree(p->kstack);
-        p->kstack = 0;
-        freevm(p->pgdir);
         p->pid = 0;
         p->parent = 0;
         p->name[0] = 0;
@@ -365,6 +518,13 @@ scheduler(void)
       swtch(&(c->scheduler), p->context);
       switchkvm();
 
+      // An exiting process can't free the stack it runs on,
+      // so do it here now that we are off it.
+      if(p->state == ZOMBIE && p->kstack){
+        kfree(p->kstack);
+        p->kstack = 0;
+      }
+
       // Process is done running for now.
       // It should have changed its p->state before coming back.
       c->proc = 0;
@@ -410,6 +570,47 @@ yield(void)
   release(&ptable.lock);
 }
 
+// A kernel process's very first scheduling by scheduler()
+// will swtch here, and "return" to the function kproc() put
+// where forkret would find trapret.
+static void
+kprocret(void)
+{
+  // Still holding ptable.lock from scheduler.
+  release(&ptable.lock);
+}
+
+// Start a kernel process running fn(), which must never return.
+// It has no user memory, and neither kill(), setoomadj() nor the
+// OOM killer touch it.
+int
+kproc(char *name, void (*fn)(void))
+{
+  struct proc *p;
+
+  if((p = allocproc()) == 0)
+    return -1;
+  if((p->pgdir = setupkvm()) == 0){
+    kfree(p->kstack);
+    p->kstack = 0;
+    p->state = UNUSED;
+    return -1;
+  }
+  p->sz = 0;
+  p->rss = 0;
+  p->oom_adj = OOM_ADJ_MIN;
+  p->parent = 0;
+  p->kernel = 1;
+  p->context->eip = (uint)kprocret;
+  *(uint*)(p->context + 1) = (uint)fn;
+  safestrcpy(p->name, name, sizeof(p->name));
+
+  acquire(&ptable.lock);
+  p->state = RUNNABLE;
+  release(&ptable.lock);
+  return p->pid;
+}
+
 // A fork child's very first scheduling by scheduler()
 // will swtch here.  "Return" to user space.
 void
@@ -504,6 +705,8 @@ kill(int pid)
   acquire(&ptable.lock);
   for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
     if(p->pid == pid){
+      if(p->kernel)
+        break;
       p->killed = 1;
       // Wake process from sleep if necessary.
       if(p->state == SLEEPING)
@@ -516,6 +719,223 @@ kill(int pid)
   return -1;
 }
 
+// Set the OOM killer bias of process pid (0 for the caller).
+// Children inherit it across fork and spawn.
+int
+setoomadj(int pid, int adj)
+{
+  struct proc *p;
+
+  if(adj < OOM_ADJ_MIN || adj > OOM_ADJ_MAX)
+    return -1;
+  if(pid == 0)
+    pid = myproc()->pid;
+  acquire(&ptable.lock);
+  for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
+    if(p->pid == pid && p->state != UNUSED){
+      if(p->kernel)
+        break;
+      p->oom_adj = adj;
+      release(&ptable.lock);
+      return 0;
+    }
+  }
+  release(&ptable.lock);
+  return -1;
+}
+
+// Limit the resident set of process pid (0 for the caller) to
+// pages pages, 0 meaning no limit.  Pages beyond the limit are
+// not evicted at once, but the process replaces its own pages
+// rather than other processes' from now on.  Returns the previous
+// limit, or -1.  A limit of -1 just returns the current one.
+int
+setrsslimit(int pid, int pages)
+{
+  struct proc *p;
+  int old;
+
+  if(pages < -1 || pages > PHYSTOP/PGSIZE)
+    return -1;
+  if(pid == 0)
+    pid = myproc()->pid;
+  acquire(&ptable.lock);
+  for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
+    if(p->pid == pid && p->state != UNUSED){
+      old = p->rsslimit / PGSIZE;
+      if(pages != -1)
+        p->rsslimit = pages * PGSIZE;
+      release(&ptable.lock);
+      return old;
+    }
+  }
+  release(&ptable.lock);
+  return -1;
+}
+
+// How much memory killing p would give back, in pages, biased
+// towards younger processes and by p->oom_adj.  A process with
+// a score <= 0 is never chosen.
+static int
+oom_badness(struct proc *p)
+{
+  int points;
+
+  if(p->oom_adj == OOM_ADJ_MIN)
+    return 0;
+  points = (p->rss + p->swapsz) / PGSIZE;
+
+  // A long-running process has more work to lose than a young
+  // one of the same size.
+  if(ticks - p->starttick > 1000)
+    points -= points / 4;
+
+  points += p->oom_adj * (PHYSTOP/PGSIZE + NSWAP/8) / 1000;
+  return points;
+}
+
+// Called by kalloc() when both physical memory and swap are
+// exhausted.  Kills the process with the highest badness score
+// and waits up to OOM_WAIT_TICKS for its exit() to put its
+// memory back on the freelist.  The wait is bounded because the
+// caller may hold a sleeplock or log transaction that the victim
+// is blocked on; a caller holding a spinlock does not wait at
+// all.  Returns 1 if the caller should retry its allocation,
+// 0 if it should fail it.
+int
+oom_kill(void)
+{
+  struct proc *p, *victim, *dying;
+  struct proc *curproc = myproc();
+  int pid, points, best, locked;
+  uint t0;
+
+  if(curproc == 0)
+    return 0;
+  pushcli();
+  locked = mycpu()->ncli > 1;
+  popcli();
+
+  acquire(&ptable.lock);
+  victim = dying = 0;
+  best = 0;
+  for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
+    if(p->state == UNUSED || p->state == EMBRYO || p->state == ZOMBIE ||
+       p->pgdir == 0 || p == initproc || p->kernel)
+      continue;
+    if(p->killed){
+      // Already on its way out; its memory is coming back.
+      if(p != curproc)
+        dying = p;
+      continue;
+    }
+    points = oom_badness(p);
+    if(points > best){
+      victim = p;
+      best = points;
+    }
+  }
+
+  if(dying == 0){
+    if(victim == 0){
+      release(&ptable.lock);
+      return 0;
+    }
+    cprintf("oom: killed pid %d (%s) score %d rss %d swap %d\n",
+            victim->pid, victim->name, best, victim->rss, victim->swapsz);
+    victim->killed = 1;
+    if(victim->state == SLEEPING)
+      victim->state = RUNNABLE;
+    if(victim == curproc){
+      release(&ptable.lock);
+      return 0;
+    }
+    dying = victim;
+  }
+
+  if(locked){
+    release(&ptable.lock);
+    return 0;
+  }
+  pid = dying->pid;
+  t0 = ticks;
+  while(dying->pid == pid && dying->state != ZOMBIE && !curproc->killed){
+    if(ticks - t0 >= OOM_WAIT_TICKS){
+      release(&ptable.lock);
+      return 0;
+    }
+    sleep(&ticks, &ptable.lock);
+  }
+  release(&ptable.lock);
+  return !curproc->killed;
+}
+
+// Load control.  Run every THRASH_TICKS from the timer interrupt.
+// Works out each process's page-fault frequency (major faults in
+// the last interval) and the system-wide total.  While the total
+// says the system is thrashing, suspend one more process per
+// interval: the one with the highest oom_adj, then the highest
+// fault rate.  Its pages then age out and free memory for the
+// others.  Once the fault rate drops, readmit the process that
+// has waited longest; nobody is held for more than THRASH_MAXHOLD.
+void
+loadcontrol(void)
+{
+  struct proc *p, *victim, *oldest;
+  uint faults;
+  int active;
+
+  acquire(&ptable.lock);
+  faults = 0;
+  active = 0;
+  victim = oldest = 0;
+  for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
+    if(p->state == UNUSED || p->state == EMBRYO || p->state == ZOMBIE)
+      continue;
+    p->pff = p->majflt - p->pffsnap;
+    p->pffsnap = p->majflt;
+    faults += p->pff;
+    if(p->suspended){
+      if(p->killed || ticks - p->suspendtick >= THRASH_MAXHOLD){
+        p->suspended = 0;
+        wakeup1(&p->suspended);
+      } else if(oldest == 0 || p->suspendtick < oldest->suspendtick)
+        oldest = p;
+      continue;
+    }
+    if(p == initproc || p->killed)
+      continue;
+    active++;
+    if(p->pff > 0 && (victim == 0 || p->oom_adj > victim->oom_adj ||
+       (p->oom_adj == victim->oom_adj && p->pff > victim->pff)))
+      victim = p;
+  }
+
+  // Keep at least one process making progress.
+  if(faults >= THRASH_HIGH && active > 1 && victim){
+    victim->suspended = 1;
+    victim->suspendtick = ticks;
+  } else if(faults <= THRASH_LOW && oldest){
+    oldest->suspended = 0;
+    wakeup1(&oldest->suspended);
+  }
+  release(&ptable.lock);
+}
+
+// Called by trap() before returning to user space.  A process
+// suspended by load control parks here, holding no locks, until
+// it is readmitted or killed.
+void
+loadwait(void)
+{
+  struct proc *p = myproc();
+
+  acquire(&ptable.lock);
+  while(p->suspended && !p->killed)
+    sleep(&p->suspended, &ptable.lock);
+  release(&ptable.lock);
+}
+
 //PAGEBREAK: 36
 // Print a process listing to console.  For debugging.
 // Runs when user types ^P on console.
@@ -544,6 +964,8 @@ procdump(void)
     else
       state = "???";
     cprintf("%d %s %s", p->pid, state, p->name);
+    if(p->suspended)
+      cprintf(" (suspended)");
     if(p->state == SLEEPING){
       getcallerpcs((uint*)p->context->ebp+2, pc);
       for(i=0; i<10 && pc[i] != 0; i++)
@@ -555,11 +977,97 @@ procdump(void)
 
 
 
+// Return the live process whose page table is pgdir, or 0.
+// Called from reclaim without ptable.lock, like find_victim_process.
+struct proc*
+pgdirproc(pde_t *pgdir)
+{
+  struct proc *p;
+
+  for(p = ptable.proc; p < &ptable.proc[NPROC]; p++)
+    if(p->pgdir == pgdir && p->state != UNUSED && p->state != ZOMBIE)
+      return p;
+  return 0;
+}
+
+// Replace p's page table with pgdir and return the old one.
+// Done under ptable.lock, so that lockpgdir() never hands out a
+// page table that is about to go to freevm().
+pde_t*
+setpgdir(struct proc *p, pde_t *pgdir)
+{
+  pde_t *old;
+
+  acquire(&ptable.lock);
+  old = p->pgdir;
+  p->pgdir = pgdir;
+  release(&ptable.lock);
+  return old;
+}
+
+// Find the live process using pgdir and return it with
+// ptable.lock held, so that its page table cannot be freed until
+// unlockpgdir().  Returns 0, without the lock, if there is none.
+struct proc*
+lockpgdir(pde_t *pgdir)
+{
+  struct proc *p;
+
+  acquire(&ptable.lock);
+  if((p = pgdirproc(pgdir)) == 0)
+    release(&ptable.lock);
+  return p;
+}
+
+void
+unlockpgdir(void)
+{
+  release(&ptable.lock);
+}
+
+// The frame at pa, mapped at va, was pinned by fork() for being
+// shared.  If just one live page table still maps it, name that
+// mapping in the frame's struct page and give the frame back to
+// the replacement policy.  The caller holds a reference to it.
+void
+unpinshared(uint pa, uint va)
+{
+  struct proc *p;
+  struct page *pg;
+  pde_t *last;
+  pte_t *pte;
+  int n;
+
+  pg = pa2page(pa);
+  last = 0;
+  n = 0;
+  acquire(&ptable.lock);
+  for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
+    if(p->state == UNUSED || p->state == ZOMBIE || p->pgdir == 0)
+      continue;
+    pte = walkpgdir(p->pgdir, (char*)va, 0);
+    if(pte && (*pte & PTE_P) && PTE_ADDR(*pte) == pa){
+      last = p->pgdir;
+      n++;
+    }
+  }
+  if(n == 1){
+    pg->pgdir = last;
+    pg->va = va;
+    repl_unpin(pg);
+  }
+  release(&ptable.lock);
+}
+
 struct proc* find_victim_process()
 {
     struct proc *p, *victim = 0;
     for(p = ptable.proc; p < &ptable.proc[NPROC]; p++)
     {
+        // Unused, embryo and zombie slots have no address space.
+        if(p->state == UNUSED || p->state == EMBRYO || p->state == ZOMBIE || p->pgdir == 0)
+            continue;
+
         if(victim == 0)
         {
           victim = p;
@@ -570,9 +1078,6 @@ struct proc* find_victim_process()
             victim = p;
     }
 
-    if (victim == 0)
-        panic("find_victim_process: No runnable process found");
-
     return victim;
 }
 
@@ -599,6 +1104,10 @@ pte_t* find_victim_pte(struct proc *victim_p)
         if((*pte & PTE_P) == 0)
             continue;
 
+        // mlock()ed pages are never victims
+        if(pa2page(PTE_ADDR(*pte))->flags & PG_PINNED)
+            continue;
+
         if((*pte & PTE_A) == 0) {
             // cprintf("Found victim pte: va = %x, *pte = %x\n", i, *pte);
             return pte;
@@ -639,6 +1148,10 @@ pte_t* find_victim_pte(struct proc *victim_p)
         if((*pte & PTE_P) == 0)
             continue;
 
+        // mlock()ed pages are never victims
+        if(pa2page(PTE_ADDR(*pte))->flags & PG_PINNED)
+            continue;
+
         if((*pte & PTE_A) == 0) {
             return pte;
         }
@@ -646,22 +1159,3 @@ pte_t* find_victim_pte(struct proc *victim_p)
 
     return 0; // No victim page found
 }
-
-
-void clear_swap(pde_t *pgdir, struct proc *p)
-{
-    pte_t *pte;
-    for(uint i = 0; i < p->sz; i += PGSIZE)
-    {
-        if((pte = walkpgdir(pgdir, (void *) i, 0)) == 0)
-            continue;
-        
-        if((*pte & PTE_P) == 0)
-        {
-          if (*pte & 0x008)
-          {
-            freepage(pte);
-          }
-        }
-    }
-}
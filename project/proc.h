@@ -8,6 +8,7 @@ struct cpu {
   int ncli;                    // Depth of pushcli nesting.
   int intena;                  // Were interrupts enabled before pushcli?
   struct proc *proc;           // The process running on this cpu or null
+  volatile uint tlbflushes;    // T_TLBFLUSH IPIs handled, see tlbflush()
 };
 
 extern struct cpu cpus[NCPU];
@@ -34,10 +35,22 @@ struct context {
 
 enum procstate { UNUSED, EMBRYO, SLEEPING, RUNNABLE, RUNNING, ZOMBIE };
 
+// A region mapped by mmap() (see mmap.c).
+struct vma {
+  uint start;                  // First address, or 0 if the slot is free
+  uint end;                    // One past the last address
+  int prot;                    // PROT_*
+  int flags;                   // MAP_*
+  struct file *f;              // File mapped, or 0 if anonymous
+  uint off;                    // File offset of start
+  struct shmseg *seg;          // Shared memory segment, if shmat()ed
+};
+
 // Per-process state
 struct proc {
   uint sz;
   uint rss;                     // Size of process memory (bytes)
+  uint swapsz;                  // Size of process memory in swap (bytes)
   pde_t* pgdir;                // Page table
   char *kstack;                // Bottom of kernel stack for this process
   enum procstate state;        // Process state
@@ -50,6 +63,20 @@ struct proc {
   struct file *ofile[NOFILE];  // Open files
   struct inode *cwd;           // Current directory
   char name[16];               // Process name (debugging)
+  uint starttick;              // ticks when the process was created
+  int oom_adj;                 // OOM killer bias, OOM_ADJ_MIN..OOM_ADJ_MAX
+  uint rsslimit;               // Resident set limit in bytes, 0 if none
+  int advice;                  // MADV_* for [advstart, advend)
+  uint advstart;
+  uint advend;
+  struct vma vma[NVMA];        // mmap() regions
+  char argstrbuf[2][MAXARGSTR]; // argstr() copies of mapped strings
+  uint majflt;                 // Pages swapped back in for this process
+  uint pffsnap;                // majflt at the last load-control check
+  uint pff;                    // Major faults in the last check interval
+  int suspended;               // If non-zero, held back by load control
+  uint suspendtick;            // ticks when it was suspended
+  int kernel;                  // If non-zero, started by kproc()
 };
 
 // Process memory is laid out contiguously, low addresses first:
@@ -0,0 +1,46 @@
+// Show page replacement counters, and optionally switch policy.
+// usage: repl [fifo|clock|lru|rss]
+
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "replace.h"
+
+char *names[NREPL] = {
+[REPL_FIFO]   "fifo",
+[REPL_CLOCK]  "clock",
+[REPL_LRU]    "lru",
+[REPL_RSS]    "rss",
+};
+
+int
+main(int argc, char **argv)
+{
+  struct replstat st;
+  int i, cur;
+
+  if(argc > 2){
+    printf(2, "usage: repl [fifo|clock|lru|rss]\n");
+    exit();
+  }
+  if(argc == 2){
+    for(i = 0; i < NREPL; i++)
+      if(strcmp(argv[1], names[i]) == 0)
+        break;
+    if(i == NREPL || replpolicy(i) < 0){
+      printf(2, "repl: unknown policy %s\n", argv[1]);
+      exit();
+    }
+  }
+
+  cur = replpolicy(-1);
+
+  printf(1, "policy  maps unmaps samples scanned evictions majfaults\n");
+  for(i = 0; i < NREPL; i++){
+    if(replstat(i, &st) < 0)
+      continue;
+    printf(1, "%s%s %d %d %d %d %d %d\n", i == cur ? "*" : " ", names[i],
+           st.maps, st.unmaps, st.samples, st.scanned, st.evictions, st.majfaults);
+  }
+  exit();
+}
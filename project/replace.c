@@ -0,0 +1,508 @@
+// Page replacement framework.
+//
+// Mapped user frames are handed to the current policy, a table of
+// operations (struct replops):
+//   init              start with no frames tracked
+//   on_map            a user frame was mapped
+//   on_access_sample  periodic PTE_A sampling, from the timer
+//   on_unmap          a frame is freed or chosen for eviction
+//   pick_victim       choose a tracked frame to evict, optionally
+//                     only one mapped by a given page table
+//   deactivate        make a frame the next candidate for eviction
+// All calls are made with repl.lock held.  A frame is tracked while
+// PG_LRU is set; switching policy hands every tracked frame to the
+// new policy.  Pinned (mlock()ed) frames are not tracked at all, so
+// no policy ever has to look at them.  The built-in policies are FIFO and CLOCK (below),
+// two-list LRU (lru.c), and the original largest-RSS heuristic.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "memlayout.h"
+#include "mmu.h"
+#include "proc.h"
+#include "spinlock.h"
+#include "page.h"
+#include "replace.h"
+
+extern struct replops fifoops, clockops, lruops, rssops;
+
+static struct replops *policies[NREPL] = {
+[REPL_FIFO]   &fifoops,
+[REPL_CLOCK]  &clockops,
+[REPL_LRU]    &lruops,
+[REPL_RSS]    &rssops,
+};
+
+struct {
+  struct spinlock lock;
+  int policy;
+  struct replops *ops;
+  struct replstat stat[NREPL];
+} repl;
+
+// Lists of frames threaded through struct page, with a struct
+// page as the list head.
+void
+plist_init(struct page *head)
+{
+  head->lru_next = head->lru_prev = head;
+}
+
+// Insert pg after head, i.e. at the head of the list.
+void
+plist_add(struct page *head, struct page *pg)
+{
+  pg->lru_next = head->lru_next;
+  pg->lru_prev = head;
+  head->lru_next->lru_prev = pg;
+  head->lru_next = pg;
+}
+
+void
+plist_del(struct page *pg)
+{
+  pg->lru_prev->lru_next = pg->lru_next;
+  pg->lru_next->lru_prev = pg->lru_prev;
+  pg->lru_next = pg->lru_prev = 0;
+}
+
+// Return the user PTE that maps pg, or 0 if it is not
+// (or no longer) mapped where its struct page says.
+pte_t*
+replpte(struct page *pg)
+{
+  pte_t *pte;
+
+  if(pg->pgdir == 0)
+    return 0;
+  pte = walkpgdir(pg->pgdir, (void*)pg->va, 0);
+  if(pte == 0 || (*pte & PTE_P) == 0 || PTE_ADDR(*pte) != page2pa(pg))
+    return 0;
+  return pte;
+}
+
+// PTE_A has two consumers: the replacement policy and working-set
+// sampling (wset.c).  Whichever clears the hardware bit leaves a
+// note in the struct page for the other, so neither hides
+// references from the other.  mine and other are PG_REPLREF and
+// PG_WSREF in some order.
+static int
+harvest(pte_t *pte, struct page *pg, uint mine, uint other)
+{
+  int ref;
+
+  ref = (pg->flags & mine) != 0;
+  pg->flags &= ~mine;
+  if(*pte & PTE_A){
+    *pte &= ~PTE_A;
+    pg->flags |= other;
+    ref = 1;
+  }
+  return ref;
+}
+
+// Test and clear the accessed bit of the PTE mapping pg.
+int
+replreferenced(struct page *pg)
+{
+  pte_t *pte;
+
+  repl.stat[repl.policy].scanned++;
+  if((pte = replpte(pg)) == 0)
+    return 0;
+  return harvest(pte, pg, PG_REPLREF, PG_WSREF);
+}
+
+// Working-set sample of the address space pgdir of size sz: bump
+// counts[i] (saturating) for every resident page i referenced since
+// the last sample, for at most n pages.  Returns the number of
+// pages covered.
+int
+repl_wssample(pde_t *pgdir, uint sz, uchar *counts, int n)
+{
+  pte_t *pte;
+  uint va;
+  int i;
+
+  acquire(&repl.lock);
+  for(i = 0, va = 0; va < sz && i < n; i++, va += PGSIZE){
+    pte = walkpgdir(pgdir, (void*)va, 0);
+    if(pte == 0 || (*pte & PTE_P) == 0 || (*pte & PTE_U) == 0)
+      continue;
+    if(harvest(pte, pa2page(PTE_ADDR(*pte)), PG_WSREF, PG_REPLREF) &&
+       counts[i] < 255)
+      counts[i]++;
+  }
+  release(&repl.lock);
+  return i;
+}
+
+// Can pg be evicted now, on behalf of owner (0 for anyone)?
+// Frames of an image that exec is still building have no live
+// owner yet.  Shared memory frames belong to no one process, so
+// only global reclaim takes them.
+int
+replevictable(struct page *pg, pde_t *owner)
+{
+  if(pg->flags & PG_SHM)
+    return owner == 0 && replpte(pg) != 0;
+  if(owner && pg->pgdir != owner)
+    return 0;
+  return replpte(pg) != 0 && pgdirproc(pg->pgdir) != 0;
+}
+
+void
+replinit(void)
+{
+  initlock(&repl.lock, "repl");
+  repl.policy = REPLPOLICY;
+  repl.ops = policies[repl.policy];
+  repl.ops->init();
+}
+
+// A user frame was mapped; start tracking it.
+void
+repl_map(struct page *pg)
+{
+  acquire(&repl.lock);
+  if((pg->flags & (PG_LRU|PG_PINNED)) == 0){
+    pg->flags |= PG_LRU;
+    repl.ops->on_map(pg);
+    repl.stat[repl.policy].maps++;
+  }
+  release(&repl.lock);
+}
+
+// Stop tracking a frame, e.g. because it is being freed.
+void
+repl_unmap(struct page *pg)
+{
+  acquire(&repl.lock);
+  if(pg->flags & PG_LRU){
+    repl.ops->on_unmap(pg);
+    pg->flags &= ~PG_LRU;
+    repl.stat[repl.policy].unmaps++;
+  }
+  release(&repl.lock);
+}
+
+// Pin pg in memory by taking it away from the policy.  Returns 0
+// if pg is not tracked, e.g. because it is being evicted.
+int
+repl_pin(struct page *pg)
+{
+  int ok;
+
+  acquire(&repl.lock);
+  ok = 1;
+  if(pg->flags & PG_LRU){
+    repl.ops->on_unmap(pg);
+    pg->flags &= ~PG_LRU;
+    pg->flags |= PG_PINNED;
+    repl.stat[repl.policy].unmaps++;
+  } else if((pg->flags & PG_PINNED) == 0)
+    ok = 0;
+  release(&repl.lock);
+  return ok;
+}
+
+// Unpin pg and give it back to the policy.
+void
+repl_unpin(struct page *pg)
+{
+  acquire(&repl.lock);
+  if(pg->flags & PG_PINNED){
+    pg->flags &= ~PG_PINNED;
+    pg->flags |= PG_LRU;
+    repl.ops->on_map(pg);
+    repl.stat[repl.policy].maps++;
+  }
+  release(&repl.lock);
+}
+
+// Periodic access sampling, from the timer interrupt.
+void
+repl_sample(void)
+{
+  acquire(&repl.lock);
+  repl.ops->on_access_sample();
+  repl.stat[repl.policy].samples++;
+  release(&repl.lock);
+}
+
+// Choose a frame to evict, stop tracking it and take a reference
+// to it, which the caller must drop with kfree().  If owner is not
+// 0, only frames mapped by that page table are considered (local
+// reclaim).  Returns 0 if no evictable frame could be found.
+struct page*
+repl_victim(pde_t *owner)
+{
+  struct page *pg;
+
+  acquire(&repl.lock);
+  while((pg = repl.ops->pick_victim(owner)) != 0){
+    repl.ops->on_unmap(pg);
+    pg->flags &= ~PG_LRU;
+    repl.stat[repl.policy].unmaps++;
+    // A frame whose last reference kfree() is dropping right now
+    // is skipped; kfree() finishes freeing it.
+    if(ktrydup(pg)){
+      repl.stat[repl.policy].evictions++;
+      break;
+    }
+  }
+  release(&repl.lock);
+  return pg;
+}
+
+// Hint that pg will not be used again soon, e.g. it is behind a
+// sequential scan: clear its accessed bit and have the policy
+// consider it for eviction first.
+void
+repl_deactivate(struct page *pg)
+{
+  pte_t *pte;
+
+  acquire(&repl.lock);
+  if(pg->flags & PG_LRU){
+    if((pte = replpte(pg)) != 0)
+      harvest(pte, pg, PG_REPLREF, PG_WSREF);
+    repl.ops->deactivate(pg);
+  }
+  release(&repl.lock);
+}
+
+// A page was swapped back in.
+void
+repl_fault(void)
+{
+  acquire(&repl.lock);
+  repl.stat[repl.policy].majfaults++;
+  release(&repl.lock);
+}
+
+// Switch to replacement policy policy, handing it every tracked
+// frame.  Returns the previous policy, or -1 if policy is invalid.
+// A policy of -1 just returns the current one.
+int
+setreplpolicy(int policy)
+{
+  struct page *pg, *frames;
+  int i, n, old;
+
+  if(policy < -1 || policy >= NREPL)
+    return -1;
+  acquire(&repl.lock);
+  old = repl.policy;
+  if(policy != -1 && policy != old){
+    repl.policy = policy;
+    repl.ops = policies[policy];
+    repl.ops->init();
+    frames = framearray(&n);
+    for(i = 0; i < n; i++){
+      pg = &frames[i];
+      if(pg->flags & PG_LRU){
+        pg->flags &= ~PG_ACTIVE;
+        repl.ops->on_map(pg);
+      }
+    }
+  }
+  release(&repl.lock);
+  return old;
+}
+
+// Copy out the counters of policy.  st may be user memory, which
+// can fault, so it is written after repl.lock is released.
+int
+getreplstat(int policy, struct replstat *st)
+{
+  struct replstat s;
+
+  if(policy < 0 || policy >= NREPL)
+    return -1;
+  acquire(&repl.lock);
+  s = repl.stat[policy];
+  release(&repl.lock);
+  *st = s;
+  return 0;
+}
+
+//PAGEBREAK!
+// FIFO: evict frames in the order they were mapped.
+
+static struct page fifo;
+
+static void
+fifo_init(void)
+{
+  plist_init(&fifo);
+}
+
+static void
+fifo_map(struct page *pg)
+{
+  plist_add(&fifo, pg);
+}
+
+static void
+fifo_sample(void)
+{
+}
+
+static void
+fifo_unmap(struct page *pg)
+{
+  plist_del(pg);
+}
+
+static struct page*
+fifo_victim(pde_t *owner)
+{
+  struct page *pg;
+
+  for(pg = fifo.lru_prev; pg != &fifo; pg = pg->lru_prev)
+    if(replevictable(pg, owner))
+      return pg;
+  return 0;
+}
+
+// Move pg to the tail, where victims are taken from.
+static void
+fifo_deactivate(struct page *pg)
+{
+  plist_del(pg);
+  plist_add(fifo.lru_prev, pg);
+}
+
+struct replops fifoops = {
+  "fifo", fifo_init, fifo_map, fifo_sample, fifo_unmap, fifo_victim,
+  fifo_deactivate,
+};
+
+// CLOCK: frames sit on a ring swept by a hand.  A referenced
+// frame has PTE_A cleared and is passed over; the first frame
+// found unreferenced is the victim.  New frames go just behind
+// the hand, so they are the last to be looked at.
+
+static struct page clock;
+static struct page *hand;
+static int nclock;        // frames on the ring
+
+static void
+clock_init(void)
+{
+  plist_init(&clock);
+  hand = &clock;
+  nclock = 0;
+}
+
+static void
+clock_map(struct page *pg)
+{
+  plist_add(hand->lru_prev, pg);
+  nclock++;
+}
+
+static void
+clock_sample(void)
+{
+}
+
+static void
+clock_unmap(struct page *pg)
+{
+  if(hand == pg)
+    hand = pg->lru_next;
+  plist_del(pg);
+  nclock--;
+}
+
+static struct page*
+clock_victim(pde_t *owner)
+{
+  struct page *pg;
+  int scan;
+
+  // Two sweeps: the first may only clear PTE_A bits.
+  for(scan = 2*nclock + 1; scan > 0; scan--){
+    pg = hand;
+    hand = hand->lru_next;
+    if(pg == &clock)
+      continue;
+    if(replreferenced(pg) || !replevictable(pg, owner))
+      continue;
+    return pg;
+  }
+  return 0;
+}
+
+// Put pg under the hand, so it is the next frame looked at.
+static void
+clock_deactivate(struct page *pg)
+{
+  clock_unmap(pg);
+  plist_add(hand->lru_prev, pg);
+  nclock++;
+  hand = pg;
+}
+
+struct replops clockops = {
+  "clock", clock_init, clock_map, clock_sample, clock_unmap, clock_victim,
+  clock_deactivate,
+};
+
+// RSS: the original heuristic.  Pick the process with the largest
+// resident set and, within it, the first page whose PTE_A is clear
+// (see find_victim_process and find_victim_pte in proc.c), or
+// the owner's first such page for local reclaim.  It keeps no
+// per-frame state.
+
+static void
+rss_init(void)
+{
+}
+
+static void
+rss_map(struct page *pg)
+{
+}
+
+static void
+rss_sample(void)
+{
+}
+
+static void
+rss_unmap(struct page *pg)
+{
+}
+
+static struct page*
+rss_victim(pde_t *owner)
+{
+  struct proc *p;
+  pte_t *pte;
+  struct page *pg;
+
+  p = owner ? pgdirproc(owner) : find_victim_process();
+  if(p == 0)
+    return 0;
+  if((pte = find_victim_pte(p)) == 0)
+    return 0;
+  pg = pa2page(PTE_ADDR(*pte));
+  if((pg->flags & PG_LRU) == 0 || !replevictable(pg, owner))
+    return 0;
+  return pg;
+}
+
+// Clearing PTE_A (done by repl_deactivate) is all it takes.
+static void
+rss_deactivate(struct page *pg)
+{
+}
+
+struct replops rssops = {
+  "rss", rss_init, rss_map, rss_sample, rss_unmap, rss_victim,
+  rss_deactivate,
+};
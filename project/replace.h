@@ -0,0 +1,17 @@
+// Page replacement policies, selectable at boot (REPLPOLICY in
+// param.h) or at run time with replpolicy().
+#define REPL_FIFO   0  // evict in mapping order
+#define REPL_CLOCK  1  // second chance around a single ring
+#define REPL_LRU    2  // active/inactive lists, see lru.c
+#define REPL_RSS    3  // unaccessed page of the largest process
+#define NREPL       4
+
+// Per-policy counters, returned by replstat().
+struct replstat {
+  uint maps;        // frames handed to the policy
+  uint unmaps;      // frames taken away (freed or evicted)
+  uint samples;     // aging passes run
+  uint scanned;     // PTE_A bits tested
+  uint evictions;   // victims chosen
+  uint majfaults;   // pages swapped back in while the policy was active
+};
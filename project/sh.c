@@ -50,6 +50,7 @@ struct backcmd {
 };
 
 int fork1(void);  // Fork but panics on failure.
+int spawncmd(char*);
 void panic(char*);
 struct cmd *parsecmd(char*);
 
@@ -164,6 +165,8 @@ main(void)
         printf(2, "cannot cd %s\n", buf+3);
       continue;
     }
+    if(spawncmd(buf) == 0)
+      continue;
     if(fork1() == 0)
       runcmd(parsecmd(buf));
     wait();
@@ -262,6 +265,43 @@ backcmd(struct cmd *subcmd)
 char whitespace[] = " \t\r\n\v";
 char symbols[] = "<|>&;()";
 
+// Run a simple command (no redirection, pipes, lists or
+// background) with spawn(), so the shell is not copied just to be
+// replaced by exec.  Returns -1 without touching buf if the command
+// needs the full runcmd treatment.
+int
+spawncmd(char *buf)
+{
+  char *argv[MAXARGS], *s;
+  int argc;
+
+  argc = 0;
+  for(s = buf; *s; s++){
+    if(strchr(symbols, *s))
+      return -1;
+    if(!strchr(whitespace, *s) && (s == buf || strchr(whitespace, s[-1])))
+      argc++;
+  }
+  if(argc == 0 || argc >= MAXARGS)
+    return -1;
+
+  argc = 0;
+  for(s = buf; *s; s++){
+    if(strchr(whitespace, *s))
+      *s = 0;
+    else if(s == buf || s[-1] == 0)
+      argv[argc++] = s;
+  }
+  argv[argc] = 0;
+
+  if(spawn(argv[0], argv, 0) < 0){
+    printf(2, "exec %s failed\n", argv[0]);
+    return 0;
+  }
+  wait();
+  return 0;
+}
+
 int
 gettoken(char **ps, char *es, char **q, char **eq)
 {
@@ -0,0 +1,417 @@
+// Named shared-memory segments.
+//
+// shmget() finds or creates a segment by name, shmat() maps it
+// into the mmap() area of the calling process (as a vma with seg
+// set), shmdt() unmaps it and shmrm() marks it for removal once no
+// process has it attached.
+//
+// A segment owns its frames.  seg->pages[i] is the physical
+// address of page i, a swap entry (slot<<12 | 0x008) if page i is
+// out in swap, or 0 if it has never been touched.  The segment
+// holds one reference to each resident frame and every PTE that
+// maps it holds another.  Attached PTEs are either present or 0;
+// a page that is not present is found through the segment on the
+// next fault, so swap entries never appear in process page tables.
+//
+// Resident frames are tracked by the replacement policy like any
+// other user page (PG_SHM, with pgdir and va naming one of the
+// attachments).  Evicting one (shm_evict) and bringing one back in
+// (shm_fault) update the PTEs of every attachment.
+//
+// shm.lock protects the table and every segment's pages and
+// attachments.  seg->lock serialises faults on one segment, which
+// may sleep reading swap; eviction only needs shm.lock.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "memlayout.h"
+#include "mmu.h"
+#include "x86.h"
+#include "proc.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "page.h"
+#include "mman.h"
+
+struct shmseg {
+  char name[SHMNAME];     // name[0] == 0 if the slot is free
+  uint npages;
+  int removed;            // shmrm() called; free once unattached
+  int nattach;
+  struct sleeplock lock;  // serialises faults
+  pde_t *pgdir[NSHMATTACH]; // attachments, by page table
+  uint va[NSHMATTACH];
+  uint pages[SHMMAXPAGES];
+};
+
+struct {
+  struct spinlock lock;
+  struct shmseg seg[NSHM];
+} shm;
+
+void
+shminit(void)
+{
+  struct shmseg *s;
+
+  initlock(&shm.lock, "shm");
+  for(s = shm.seg; s < &shm.seg[NSHM]; s++)
+    initsleeplock(&s->lock, "shmseg");
+}
+
+// Find or create the segment called name, of npages pages.
+// Returns its id, or -1.
+int
+shmget(char *name, uint npages)
+{
+  struct shmseg *s, *free;
+
+  if(name[0] == 0 || strlen(name) >= SHMNAME)
+    return -1;
+  acquire(&shm.lock);
+  free = 0;
+  for(s = shm.seg; s < &shm.seg[NSHM]; s++){
+    if(s->name[0] == 0){
+      if(free == 0)
+        free = s;
+    } else if(strncmp(s->name, name, SHMNAME) == 0 && !s->removed){
+      release(&shm.lock);
+      return npages <= s->npages ? s - shm.seg : -1;
+    }
+  }
+  if(free == 0 || npages == 0 || npages > SHMMAXPAGES ||
+     commit_charge(npages) < 0){
+    release(&shm.lock);
+    return -1;
+  }
+  s = free;
+  safestrcpy(s->name, name, SHMNAME);
+  s->npages = npages;
+  s->removed = 0;
+  s->nattach = 0;
+  memset(s->pages, 0, sizeof(s->pages));
+  release(&shm.lock);
+  return s - shm.seg;
+}
+
+// Give back a segment's frames and swap slots.
+// Called with shm.lock held.
+static void
+shmfree(struct shmseg *s)
+{
+  uint i;
+
+  for(i = 0; i < s->npages; i++){
+    if(s->pages[i] & 0x008)
+      freepage(&s->pages[i]);
+    else if(s->pages[i])
+      kfree(P2V(s->pages[i]));
+    s->pages[i] = 0;
+  }
+  commit_uncharge(s->npages);
+  s->name[0] = 0;
+}
+
+// Attach segment id to the current process.  Returns the address
+// it is mapped at, or -1.
+int
+shmat(int id)
+{
+  struct proc *p = myproc();
+  struct shmseg *s;
+  struct vma *v;
+  int i;
+
+  if(id < 0 || id >= NSHM)
+    return -1;
+  s = &shm.seg[id];
+  for(v = p->vma; v < &p->vma[NVMA]; v++)
+    if(v->start == 0)
+      break;
+  if(v == &p->vma[NVMA])
+    return -1;
+
+  acquire(&shm.lock);
+  if(s->name[0] == 0 || s->removed || s->nattach == NSHMATTACH ||
+     (v->start = mmap_gap(p, s->npages * PGSIZE)) == 0){
+    release(&shm.lock);
+    return -1;
+  }
+  for(i = 0; s->pgdir[i]; i++)
+    ;
+  s->pgdir[i] = p->pgdir;
+  s->va[i] = v->start;
+  s->nattach++;
+  release(&shm.lock);
+
+  v->end = v->start + s->npages * PGSIZE;
+  v->prot = PROT_READ|PROT_WRITE;
+  v->flags = MAP_SHARED;
+  v->f = 0;
+  v->off = 0;
+  v->seg = s;
+  return v->start;
+}
+
+// Also attach the segment of vma v of a forking process to the
+// child's page table.  The child faults the pages in itself.
+int
+shm_fork(struct vma *v, pde_t *pgdir)
+{
+  struct shmseg *s = v->seg;
+  int i;
+
+  acquire(&shm.lock);
+  if(s->nattach == NSHMATTACH){
+    release(&shm.lock);
+    return -1;
+  }
+  for(i = 0; s->pgdir[i]; i++)
+    ;
+  s->pgdir[i] = pgdir;
+  s->va[i] = v->start;
+  s->nattach++;
+  release(&shm.lock);
+  return 0;
+}
+
+// Detach the segment mapped by vma v from p, and free the
+// segment if it was the last attachment of a removed segment.
+void
+shm_detach(struct proc *p, struct vma *v)
+{
+  struct shmseg *s = v->seg;
+  struct page *pg;
+  pte_t *pte;
+  uint i, pa;
+  int j, k;
+
+  acquire(&shm.lock);
+  for(j = 0; j < NSHMATTACH; j++)
+    if(s->pgdir[j] == p->pgdir && s->va[j] == v->start)
+      break;
+  if(j == NSHMATTACH)
+    panic("shmdt");
+
+  for(i = 0; i < s->npages; i++){
+    pte = walkpgdir(p->pgdir, (char*)v->start + i*PGSIZE, 0);
+    if(pte == 0 || (*pte & PTE_P) == 0)
+      continue;
+    pa = PTE_ADDR(*pte);
+    *pte = 0;
+    p->rss -= PGSIZE;
+    pg = pa2page(pa);
+    if(pg->pgdir == p->pgdir && pg->va == v->start + i*PGSIZE){
+      // The frame's struct page names this mapping; name another.
+      pg->pgdir = 0;
+      for(k = 0; k < NSHMATTACH; k++){
+        if(k != j && s->pgdir[k]){
+          pte = walkpgdir(s->pgdir[k], (char*)s->va[k] + i*PGSIZE, 0);
+          if(pte && (*pte & PTE_P)){
+            pg->pgdir = s->pgdir[k];
+            pg->va = s->va[k] + i*PGSIZE;
+            break;
+          }
+        }
+      }
+    }
+    kfree(P2V(pa));
+  }
+  if(p == myproc())
+    lcr3(V2P(p->pgdir));
+
+  s->pgdir[j] = 0;
+  s->nattach--;
+  if(s->nattach == 0 && s->removed)
+    shmfree(s);
+  release(&shm.lock);
+  v->start = v->end = 0;
+  v->seg = 0;
+}
+
+// Detach the segment attached at addr from the current process.
+int
+shmdt(uint addr)
+{
+  struct proc *p = myproc();
+  struct vma *v;
+
+  for(v = p->vma; v < &p->vma[NVMA]; v++){
+    if(v->seg && v->start == addr){
+      shm_detach(p, v);
+      return 0;
+    }
+  }
+  return -1;
+}
+
+// Remove segment id once the last process detaches from it.
+int
+shmrm(int id)
+{
+  struct shmseg *s;
+
+  if(id < 0 || id >= NSHM)
+    return -1;
+  s = &shm.seg[id];
+  acquire(&shm.lock);
+  if(s->name[0] == 0 || s->removed){
+    release(&shm.lock);
+    return -1;
+  }
+  s->removed = 1;
+  if(s->nattach == 0)
+    shmfree(s);
+  release(&shm.lock);
+  return 0;
+}
+
+// Map resident page i of s at every attachment that does not map
+// it yet and already has a page table for it.  Mapping where a
+// page table would have to be allocated could recurse into
+// eviction; those attachments fault the page in later.
+// Called with shm.lock held.
+static void
+shminstall(struct shmseg *s, uint i)
+{
+  struct proc *p;
+  struct page *pg;
+  pte_t *pte;
+  int j;
+
+  pg = pa2page(s->pages[i]);
+  pg->flags |= PG_SHM;
+  pg->shm = s;
+  pg->shmidx = i;
+  for(j = 0; j < NSHMATTACH; j++){
+    if(s->pgdir[j] == 0)
+      continue;
+    pte = walkpgdir(s->pgdir[j], (char*)s->va[j] + i*PGSIZE, 0);
+    if(pte == 0 || *pte != 0)
+      continue;
+    kdup(P2V(s->pages[i]));
+    mappage(s->pgdir[j], s->va[j] + i*PGSIZE, P2V(s->pages[i]), PTE_W|PTE_U);
+    if((p = pgdirproc(s->pgdir[j])) != 0)
+      p->rss += PGSIZE;
+  }
+}
+
+// Fault in the page at va of p, in segment mapping v.
+// Returns -1 if there is no memory for it.
+int
+shm_fault(struct proc *p, struct vma *v, uint va)
+{
+  struct shmseg *s = v->seg;
+  uint i, e;
+  char *mem;
+
+  va = PGROUNDDOWN(va);
+  i = (va - v->start) / PGSIZE;
+  // Make sure our own page table exists, so that shminstall()
+  // maps the page for us at least.
+  if(walkpgdir(p->pgdir, (char*)va, 1) == 0)
+    return -1;
+
+  acquiresleep(&s->lock);
+  acquire(&shm.lock);
+  e = s->pages[i];
+  release(&shm.lock);
+
+  mem = 0;
+  if(e == 0 || (e & 0x008)){
+    if((mem = kalloc()) == 0){
+      releasesleep(&s->lock);
+      return -1;
+    }
+    if(e == 0)
+      memset(mem, 0, PGSIZE);
+    else {
+      swap_read(e, mem);
+      repl_fault();
+      p->majflt++;
+    }
+  }
+
+  acquire(&shm.lock);
+  if(mem){
+    if(e & 0x008)
+      freepage(&s->pages[i]);
+    s->pages[i] = V2P(mem);
+  }
+  shminstall(s, i);
+  release(&shm.lock);
+  releasesleep(&s->lock);
+  return 0;
+}
+
+// Swap-out of the shared frame pg to the swap entry e, before its
+// contents are written there: unmap it from every attachment,
+// flush their TLBs and record e in the segment, so that no write
+// to the page can be lost.  The caller holds a reference of its
+// own, which becomes the only one.  Returns 0 if the frame left
+// the segment meanwhile, in which case e is not needed.
+int
+shm_evict(struct page *pg, uint e)
+{
+  struct shmseg *s;
+  struct proc *p;
+  pte_t *pte;
+  pde_t *flush[NSHMATTACH];
+  uint i, pa;
+  int j, n;
+
+  n = 0;
+  acquire(&shm.lock);
+  s = pg->shm;
+  i = pg->shmidx;
+  pa = page2pa(pg);
+  if((pg->flags & PG_SHM) == 0 || s->pages[i] != pa){
+    release(&shm.lock);
+    return 0;
+  }
+  for(j = 0; j < NSHMATTACH; j++){
+    if(s->pgdir[j] == 0)
+      continue;
+    pte = walkpgdir(s->pgdir[j], (char*)s->va[j] + i*PGSIZE, 0);
+    if(pte == 0 || PTE_ADDR(*pte) != pa || (*pte & PTE_P) == 0)
+      continue;
+    *pte = 0;
+    if((p = pgdirproc(s->pgdir[j])) != 0)
+      p->rss -= PGSIZE;
+    flush[n++] = s->pgdir[j];
+    kfree(P2V(pa));
+  }
+  s->pages[i] = e;
+  kfree(P2V(pa));      // the segment's reference
+  release(&shm.lock);
+  // tlbflush() waits for other CPUs, so not under shm.lock.  An
+  // attachment that goes away meanwhile is flushed for nothing.
+  for(j = 0; j < n; j++)
+    tlbflush(flush[j]);
+  return 1;
+}
+
+// The swap-out that shm_evict() unmapped pg for has failed: put
+// the frame back in the segment, which takes over the caller's
+// reference, and map it again.  Returns 0, doing nothing, if the
+// segment has since faulted the page back in or gone away.
+int
+shm_unevict(struct page *pg, uint e)
+{
+  struct shmseg *s;
+  uint i;
+
+  acquire(&shm.lock);
+  s = pg->shm;
+  i = pg->shmidx;
+  if((pg->flags & PG_SHM) == 0 || s->name[0] == 0 || s->pages[i] != e){
+    release(&shm.lock);
+    return 0;
+  }
+  s->pages[i] = page2pa(pg);
+  shminstall(s, i);
+  release(&shm.lock);
+  repl_map(pg);
+  return 1;
+}
@@ -0,0 +1,313 @@
+// Buffered I/O on file descriptors.
+//
+// There is one stream per file descriptor: fdopen(fd) returns it,
+// and printf(1, ...) and gets() use those of fds 1 and 0.  Unless
+// setvbuf() says otherwise, a stream on the console is line
+// buffered, one on a file or pipe is fully buffered, and fd 2 is
+// not buffered.  Output is flushed by fflush() and fclose(), when
+// a line-buffered stream is read from, and on exit(), fork(),
+// exec() and spawn() (see ulib.c).  close() on an fd flushes its
+// stream and frees it, so a later fdopen() of a reused fd starts
+// afresh.
+
+#include "types.h"
+#include "stat.h"
+#include "param.h"
+#include "user.h"
+
+#define FILE_OPEN   0x1   // stream in use
+#define FILE_MALLOC 0x2   // buf came from malloc()
+
+static FILE files[NOFILE];
+static char stdinbuf[BUFSIZ];
+static char stdoutbuf[BUFSIZ];
+
+extern void (*_flushhook)(void);
+extern void (*_closehook)(int);
+
+static void
+flushall(void)
+{
+  fflush(0);
+}
+
+// Called by close(fd): flush the stream on fd, if any, and free it.
+static void
+closed(int fd)
+{
+  FILE *f;
+
+  if(fd < 0 || fd >= NOFILE)
+    return;
+  f = &files[fd];
+  if((f->flags & FILE_OPEN) == 0)
+    return;
+  fflush(f);
+  if(f->flags & FILE_MALLOC)
+    free(f->buf);
+  f->flags = 0;
+  f->buf = 0;
+}
+
+// Return the stream for fd, setting it up on first use.
+FILE*
+fdopen(int fd)
+{
+  FILE *f;
+  struct stat st;
+
+  if(fd < 0 || fd >= NOFILE)
+    return 0;
+  f = &files[fd];
+  if(f->flags & FILE_OPEN)
+    return f;
+  memset(f, 0, sizeof(*f));
+  f->fd = fd;
+  f->flags = FILE_OPEN;
+  if(fd == 2)
+    f->mode = _IONBF;
+  else if(fstat(fd, &st) >= 0 && st.type == T_DEV)
+    f->mode = _IOLBF;
+  else
+    f->mode = _IOFBF;
+  _flushhook = flushall;
+  _closehook = closed;
+  return f;
+}
+
+// Give f a buffer if it has none yet.
+static void
+getbuf(FILE *f)
+{
+  if(f->buf)
+    return;
+  if(f->mode != _IONBF){
+    if(f == &files[0])
+      f->buf = stdinbuf;
+    else if(f == &files[1])
+      f->buf = stdoutbuf;
+    else if((f->buf = malloc(BUFSIZ)) != 0)
+      f->flags |= FILE_MALLOC;
+    else
+      f->mode = _IONBF;
+    f->size = BUFSIZ;
+  }
+  if(f->mode == _IONBF){
+    f->buf = &f->ch;
+    f->size = 1;
+  }
+}
+
+// Use buf, of size bytes, for f, or a buffer of BUFSIZ bytes if
+// buf is 0.  Fails if f holds input not yet read.
+int
+setvbuf(FILE *f, char *buf, int mode, int size)
+{
+  if(mode < _IOFBF || mode > _IONBF || f->rpos != f->rend || fflush(f) < 0)
+    return -1;
+  if(f->flags & FILE_MALLOC)
+    free(f->buf);
+  f->flags &= ~FILE_MALLOC;
+  f->mode = mode;
+  f->buf = 0;
+  f->size = 0;
+  f->rpos = f->rend = 0;
+  if(mode != _IONBF && buf && size > 0){
+    f->buf = buf;
+    f->size = size;
+  }
+  return 0;
+}
+
+// Write out the output waiting in f, or in every stream if f is 0.
+int
+fflush(FILE *f)
+{
+  int n, r;
+
+  if(f == 0){
+    r = 0;
+    for(f = files; f < &files[NOFILE]; f++)
+      if((f->flags & FILE_OPEN) && fflush(f) < 0)
+        r = EOF;
+    return r;
+  }
+  for(r = 0; r < f->wpos; r += n){
+    if((n = write(f->fd, f->buf + r, f->wpos - r)) <= 0){
+      f->err = 1;
+      f->wpos = 0;
+      return EOF;
+    }
+  }
+  f->wpos = 0;
+  return 0;
+}
+
+int
+fclose(FILE *f)
+{
+  int r;
+
+  r = fflush(f);
+  if(close(f->fd) < 0)   // frees f, see closed()
+    r = EOF;
+  return r;
+}
+
+int
+fwrite(const void *buf, int size, int n, FILE *f)
+{
+  const char *p;
+  int total, i, w;
+
+  p = buf;
+  total = size * n;
+  if(total <= 0)
+    return 0;
+  getbuf(f);
+  if(f->wpos + total > f->size){
+    if(fflush(f) < 0)
+      return 0;
+    if(total >= f->size){
+      // Too big to buffer: write it directly.
+      for(i = 0; i < total; i += w){
+        if((w = write(f->fd, p + i, total - i)) <= 0){
+          f->err = 1;
+          return i / size;
+        }
+      }
+      return n;
+    }
+  }
+  memmove(f->buf + f->wpos, p, total);
+  f->wpos += total;
+  if(f->wpos == f->size)
+    return fflush(f) < 0 ? 0 : n;
+  if(f->mode == _IOLBF){
+    for(i = 0; i < total; i++){
+      if(p[i] == '\n')
+        return fflush(f) < 0 ? 0 : n;
+    }
+  }
+  return n;
+}
+
+int
+fputc(int c, FILE *f)
+{
+  char ch;
+
+  ch = c;
+  return fwrite(&ch, 1, 1, f) == 1 ? c & 0xff : EOF;
+}
+
+int
+fputs(const char *s, FILE *f)
+{
+  int n;
+
+  n = strlen(s);
+  return fwrite(s, 1, n, f) == n ? 0 : EOF;
+}
+
+// Read more input into f's buffer.  Line-buffered output is
+// flushed first, so that a prompt shows before input is read.
+static int
+fillbuf(FILE *f)
+{
+  FILE *g;
+  int n;
+
+  for(g = files; g < &files[NOFILE]; g++)
+    if((g->flags & FILE_OPEN) && g->mode == _IOLBF && g->wpos)
+      fflush(g);
+  getbuf(f);
+  f->rpos = f->rend = 0;
+  n = read(f->fd, f->buf, f->size);
+  if(n == 0)
+    f->eof = 1;
+  else if(n < 0)
+    f->err = 1;
+  else
+    f->rend = n;
+  return n;
+}
+
+int
+fgetc(FILE *f)
+{
+  if(f->rpos == f->rend && fillbuf(f) <= 0)
+    return EOF;
+  return f->buf[f->rpos++] & 0xff;
+}
+
+// Read up to size*n bytes, stopping early only at end of file or
+// on an error.
+int
+fread(void *buf, int size, int n, FILE *f)
+{
+  char *p;
+  int total, i, m;
+
+  p = buf;
+  total = size * n;
+  for(i = 0; i < total; i += m){
+    if(f->rpos == f->rend && fillbuf(f) <= 0)
+      break;
+    m = f->rend - f->rpos;
+    if(m > total - i)
+      m = total - i;
+    memmove(p + i, f->buf + f->rpos, m);
+    f->rpos += m;
+  }
+  return size > 0 ? i / size : 0;
+}
+
+// Read a line, with its newline, of at most max-1 bytes.
+// Returns 0 if there was nothing to read.
+char*
+fgets(char *buf, int max, FILE *f)
+{
+  int i, c;
+
+  for(i = 0; i+1 < max; ){
+    if((c = fgetc(f)) == EOF)
+      break;
+    buf[i++] = c;
+    if(c == '\n')
+      break;
+  }
+  buf[i] = '\0';
+  return i > 0 ? buf : 0;
+}
+
+// Read a line from fd 0; a carriage return also ends it.
+char*
+gets(char *buf, int max)
+{
+  FILE *f;
+  int i, c;
+
+  f = fdopen(0);
+  for(i=0; i+1 < max; ){
+    if((c = fgetc(f)) == EOF)
+      break;
+    buf[i++] = c;
+    if(c == '\n' || c == '\r')
+      break;
+  }
+  buf[i] = '\0';
+  return buf;
+}
+
+int
+feof(FILE *f)
+{
+  return f->eof;
+}
+
+int
+ferror(FILE *f)
+{
+  return f->err;
+}
@@ -6,6 +6,7 @@
 #include "proc.h"
 #include "x86.h"
 #include "syscall.h"
+#include "mman.h"
 
 // User code makes a system call with INT T_SYSCALL.
 // System call number in %eax.
@@ -13,13 +14,47 @@
 // library system call function. The saved user %esp points
 // to a saved program counter, and then the first argument.
 
+// Return the end of the part of the current process's memory
+// that addr lies in, if it allows access prot: the end of the
+// heap, or of an mmap() region.  Returns 0 if there is none.
+static uint
+uend(uint addr, int prot)
+{
+  struct proc *curproc = myproc();
+  struct vma *v;
+
+  if(addr < curproc->sz)
+    return curproc->sz;
+  if((v = findvma(curproc, addr)) == 0 || (v->prot & prot) != prot)
+    return 0;
+  return v->end;
+}
+
+// Check that addr..addr+n lies within the current process's
+// memory and allows access prot.  A range may run on from one
+// mapping into the next.
+static int
+urange(uint addr, uint n, int prot)
+{
+  uint end;
+
+  if(addr+n < addr)
+    return -1;
+  for(;;){
+    if((end = uend(addr, prot)) == 0)
+      return -1;
+    if(addr+n <= end)
+      return 0;
+    n -= end - addr;
+    addr = end;
+  }
+}
+
 // Fetch the int at addr from the current process.
 int
 fetchint(uint addr, int *ip)
 {
-  struct proc *curproc = myproc();
-
-  if(addr >= curproc->sz || addr+4 > curproc->sz)
+  if(urange(addr, 4, PROT_READ) < 0)
     return -1;
   *ip = *(int*)(addr);
   return 0;
@@ -32,15 +67,15 @@ int
 fetchstr(uint addr, char **pp)
 {
   char *s, *ep;
-  struct proc *curproc = myproc();
+  uint end;
 
-  if(addr >= curproc->sz)
-    return -1;
   *pp = (char*)addr;
-  ep = (char*)curproc->sz;
-  for(s = *pp; s < ep; s++){
-    if(*s == 0)
-      return s - *pp;
+  s = *pp;
+  while((end = uend((uint)s, PROT_READ)) != 0){
+    for(ep = (char*)end; s < ep; s++){
+      if(*s == 0)
+        return s - *pp;
+    }
   }
   return -1;
 }
@@ -59,11 +94,25 @@ int
 argptr(int n, char **pp, int size)
 {
   int i;
-  struct proc *curproc = myproc();
- 
+
   if(argint(n, &i) < 0)
     return -1;
-  if(size < 0 || (uint)i >= curproc->sz || (uint)i+size > curproc->sz)
+  if(size < 0 || urange(i, size, PROT_READ) < 0)
+    return -1;
+  *pp = (char*)i;
+  return 0;
+}
+
+// Like argptr, for a block the kernel will write to, which
+// must not be in a read-only mapping.
+int
+argptrw(int n, char **pp, int size)
+{
+  int i;
+
+  if(argint(n, &i) < 0)
+    return -1;
+  if(size < 0 || urange(i, size, PROT_WRITE) < 0)
     return -1;
   *pp = (char*)i;
   return 0;
@@ -71,15 +120,27 @@ argptr(int n, char **pp, int size)
 
 // Fetch the nth word-sized system call argument as a string pointer.
 // Check that the pointer is valid and the string is nul-terminated.
-// (There is no shared writable memory, so the string can't change
-// between this check and being used by the kernel.)
+// A string in an mmap() region may be shared memory that another
+// process changes between this check and its use by the kernel,
+// so it is copied into the process, where it lasts until the
+// next system call.
 int
 argstr(int n, char **pp)
 {
-  int addr;
+  struct proc *curproc = myproc();
+  char *buf;
+  int addr, len;
+
   if(argint(n, &addr) < 0)
     return -1;
-  return fetchstr(addr, pp);
+  if((len = fetchstr(addr, pp)) < 0 || (uint)addr < curproc->sz)
+    return len;
+  if(n >= NELEM(curproc->argstrbuf) || len >= MAXARGSTR)
+    return -1;
+  buf = curproc->argstrbuf[n];
+  safestrcpy(buf, *pp, len+1);
+  *pp = buf;
+  return strlen(buf);
 }
 
 extern int sys_chdir(void);
@@ -105,6 +166,28 @@ extern int sys_write(void);
 extern int sys_uptime(void);
 extern int sys_getrss(void);
 extern int sys_getNumFreePages(void);
+extern int sys_spawn(void);
+extern int sys_oomadj(void);
+extern int sys_overcommit(void);
+extern int sys_replpolicy(void);
+extern int sys_replstat(void);
+extern int sys_wsctl(void);
+extern int sys_wsread(void);
+extern int sys_rsslimit(void);
+extern int sys_madvise(void);
+extern int sys_mlock(void);
+extern int sys_munlock(void);
+extern int sys_mmap(void);
+extern int sys_munmap(void);
+extern int sys_msync(void);
+extern int sys_shmget(void);
+extern int sys_shmat(void);
+extern int sys_shmdt(void);
+extern int sys_shmrm(void);
+extern int sys_splice(void);
+extern int sys_fcntl(void);
+extern int sys_poll(void);
+extern int sys_bcachesize(void);
 
 static int (*syscalls[])(void) = {
 [SYS_fork]    sys_fork,
@@ -130,6 +213,28 @@ static int (*syscalls[])(void) = {
 [SYS_close]   sys_close,
 [SYS_getrss] sys_getrss,
 [SYS_getNumFreePages]   sys_getNumFreePages,
+[SYS_spawn]   sys_spawn,
+[SYS_oomadj]  sys_oomadj,
+[SYS_overcommit] sys_overcommit,
+[SYS_replpolicy] sys_replpolicy,
+[SYS_replstat] sys_replstat,
+[SYS_wsctl]   sys_wsctl,
+[SYS_wsread]  sys_wsread,
+[SYS_rsslimit] sys_rsslimit,
+[SYS_madvise] sys_madvise,
+[SYS_mlock]   sys_mlock,
+[SYS_munlock] sys_munlock,
+[SYS_mmap]    sys_mmap,
+[SYS_munmap]  sys_munmap,
+[SYS_msync]   sys_msync,
+[SYS_shmget]  sys_shmget,
+[SYS_shmat]   sys_shmat,
+[SYS_shmdt]   sys_shmdt,
+[SYS_shmrm]   sys_shmrm,
+[SYS_splice]  sys_splice,
+[SYS_fcntl]   sys_fcntl,
+[SYS_poll]    sys_poll,
+[SYS_bcachesize] sys_bcachesize,
 };
 
 void
@@ -22,3 +22,25 @@
 #define SYS_close  21
 #define SYS_getrss 22
 #define SYS_getNumFreePages  23
+#define SYS_spawn  24
+#define SYS_oomadj 25
+#define SYS_overcommit 26
+#define SYS_replpolicy 27
+#define SYS_replstat 28
+#define SYS_wsctl  29
+#define SYS_wsread 30
+#define SYS_rsslimit 31
+#define SYS_madvise 32
+#define SYS_mlock  33
+#define SYS_munlock 34
+#define SYS_mmap   35
+#define SYS_munmap 36
+#define SYS_msync  37
+#define SYS_shmget 38
+#define SYS_shmat  39
+#define SYS_shmdt  40
+#define SYS_shmrm  41
+#define SYS_splice 42
+#define SYS_fcntl  43
+#define SYS_poll   44
+#define SYS_bcachesize 45
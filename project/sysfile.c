@@ -15,6 +15,8 @@
 #include "sleeplock.h"
 #include "file.h"
 #include "fcntl.h"
+#include "mman.h"
+#include "poll.h"
 
 // Fetch the nth word-sized system call argument as a file descriptor
 // and return both the descriptor and the corresponding struct file.
@@ -73,7 +75,7 @@ sys_read(void)
   int n;
   char *p;
 
-  if(argfd(0, 0, &f) < 0 || argint(2, &n) < 0 || argptr(1, &p, n) < 0)
+  if(argfd(0, 0, &f) < 0 || argint(2, &n) < 0 || argptrw(1, &p, n) < 0)
     return -1;
   return fileread(f, p, n);
 }
@@ -109,7 +111,7 @@ sys_fstat(void)
   struct file *f;
   struct stat *st;
 
-  if(argfd(0, 0, &f) < 0 || argptr(1, (void*)&st, sizeof(*st)) < 0)
+  if(argfd(0, 0, &f) < 0 || argptrw(1, (void*)&st, sizeof(*st)) < 0)
     return -1;
   return filestat(f, st);
 }
@@ -307,7 +309,7 @@ sys_open(void)
       return -1;
     }
     ilock(ip);
-    if(ip->type == T_DIR && omode != O_RDONLY){
+    if(ip->type == T_DIR && (omode & ~O_NONBLOCK) != O_RDONLY){
       iunlockput(ip);
       end_op();
       return -1;
@@ -329,6 +331,7 @@ sys_open(void)
   f->off = 0;
   f->readable = !(omode & O_WRONLY);
   f->writable = (omode & O_WRONLY) || (omode & O_RDWR);
+  f->nonblock = (omode & O_NONBLOCK) != 0;
   return fd;
 }
 
@@ -393,19 +396,17 @@ sys_chdir(void)
   return 0;
 }
 
-int
-sys_exec(void)
+// Fetch the nul-terminated argv array at user address uargv
+// into argv, which has room for MAXARG entries.
+static int
+fetchargv(uint uargv, char **argv)
 {
-  char *path, *argv[MAXARG];
   int i;
-  uint uargv, uarg;
+  uint uarg;
 
-  if(argstr(0, &path) < 0 || argint(1, (int*)&uargv) < 0){
-    return -1;
-  }
-  memset(argv, 0, sizeof(argv));
+  memset(argv, 0, sizeof(char*)*MAXARG);
   for(i=0;; i++){
-    if(i >= NELEM(argv))
+    if(i >= MAXARG)
       return -1;
     if(fetchint(uargv+4*i, (int*)&uarg) < 0)
       return -1;
@@ -416,9 +417,41 @@ sys_exec(void)
     if(fetchstr(uarg, &argv[i]) < 0)
       return -1;
   }
+  return 0;
+}
+
+int
+sys_exec(void)
+{
+  char *path, *argv[MAXARG];
+  uint uargv;
+
+  if(argstr(0, &path) < 0 || argint(1, (int*)&uargv) < 0){
+    return -1;
+  }
+  if(fetchargv(uargv, argv) < 0)
+    return -1;
   return exec(path, argv);
 }
 
+int
+sys_spawn(void)
+{
+  char *path, *argv[MAXARG];
+  uint uargv;
+  int ufdmap, *fdmap;
+
+  if(argstr(0, &path) < 0 || argint(1, (int*)&uargv) < 0 ||
+     argint(2, &ufdmap) < 0)
+    return -1;
+  if(fetchargv(uargv, argv) < 0)
+    return -1;
+  fdmap = 0;
+  if(ufdmap != 0 && argptr(2, (void*)&fdmap, NOFILE*sizeof(fdmap[0])) < 0)
+    return -1;
+  return spawn(path, argv, fdmap);
+}
+
 int
 sys_pipe(void)
 {
@@ -426,7 +459,7 @@ sys_pipe(void)
   struct file *rf, *wf;
   int fd0, fd1;
 
-  if(argptr(0, (void*)&fd, 2*sizeof(fd[0])) < 0)
+  if(argptrw(0, (void*)&fd, 2*sizeof(fd[0])) < 0)
     return -1;
   if(pipealloc(&rf, &wf) < 0)
     return -1;
@@ -442,3 +475,69 @@ sys_pipe(void)
   fd[1] = fd1;
   return 0;
 }
+
+// splice(fdin, fdout, n): one of the two must be a pipe.
+int
+sys_splice(void)
+{
+  struct file *in, *out;
+  int n;
+
+  if(argfd(0, 0, &in) < 0 || argfd(1, 0, &out) < 0 || argint(2, &n) < 0)
+    return -1;
+  return filesplice(in, out, n);
+}
+
+// fcntl(fd, cmd, arg), with cmd one of F_* in fcntl.h.
+int
+sys_fcntl(void)
+{
+  struct file *f;
+  int cmd, arg;
+
+  if(argfd(0, 0, &f) < 0 || argint(1, &cmd) < 0 || argint(2, &arg) < 0)
+    return -1;
+  switch(cmd){
+  case F_GETPIPE_SZ:
+    return f->type == FD_PIPE ? pipegetsize(f->pipe) : -1;
+  case F_SETPIPE_SZ:
+    return f->type == FD_PIPE ? pipesetsize(f->pipe, arg) : -1;
+  case F_GETFL:
+    return (f->readable && f->writable ? O_RDWR : f->writable ? O_WRONLY : O_RDONLY) |
+           (f->nonblock ? O_NONBLOCK : 0);
+  case F_SETFL:
+    f->nonblock = (arg & O_NONBLOCK) != 0;
+    return 0;
+  }
+  return -1;
+}
+
+// poll(fds, n, timeout): timeout in ticks, or -1 to wait forever.
+int
+sys_poll(void)
+{
+  struct pollfd *fds;
+  int n, timeout;
+
+  if(argint(1, &n) < 0 || n < 0 || n > NOFILE || argint(2, &timeout) < 0 ||
+     argptrw(0, (void*)&fds, n*sizeof(*fds)) < 0)
+    return -1;
+  return poll(fds, n, timeout);
+}
+
+// mmap(addr, len, prot, flags, fd, off); fd is ignored for
+// MAP_ANONYMOUS.
+int
+sys_mmap(void)
+{
+  int addr, len, prot, flags, fd, off;
+  struct file *f;
+
+  if(argint(0, &addr) < 0 || argint(1, &len) < 0 || argint(2, &prot) < 0 ||
+     argint(3, &flags) < 0 || argint(5, &off) < 0)
+    return -1;
+  f = 0;
+  if((flags & MAP_ANONYMOUS) == 0 && argfd(4, &fd, &f) < 0)
+    return -1;
+  return mmap(addr, len, prot, flags, f, off);
+}
@@ -6,6 +6,8 @@
 #include "memlayout.h"
 #include "mmu.h"
 #include "proc.h"
+#include "replace.h"
+#include "wset.h"
 
 
 int
@@ -14,11 +16,19 @@ sys_getNumFreePages(void)
   return num_of_FreePages();  
 }
 
+// Pages held by the buffer cache.
+int
+sys_bcachesize(void)
+{
+  return bcachepages();
+}
+
+// Print every process's RSS; returns the caller's, in pages.
 int 
 sys_getrss()
 {
   print_rss();
-  return 0;
+  return myproc()->rss / PGSIZE;
 }
 
 int
@@ -50,6 +60,80 @@ sys_kill(void)
   return kill(pid);
 }
 
+int
+sys_oomadj(void)
+{
+  int pid, adj;
+
+  if(argint(0, &pid) < 0 || argint(1, &adj) < 0)
+    return -1;
+  return setoomadj(pid, adj);
+}
+
+int
+sys_overcommit(void)
+{
+  int mode;
+
+  if(argint(0, &mode) < 0)
+    return -1;
+  return setovercommit(mode);
+}
+
+int
+sys_replpolicy(void)
+{
+  int policy;
+
+  if(argint(0, &policy) < 0)
+    return -1;
+  return setreplpolicy(policy);
+}
+
+int
+sys_replstat(void)
+{
+  int policy;
+  struct replstat *st;
+
+  if(argint(0, &policy) < 0 || argptrw(1, (void*)&st, sizeof(*st)) < 0)
+    return -1;
+  return getreplstat(policy, st);
+}
+
+int
+sys_wsctl(void)
+{
+  int pid, interval;
+
+  if(argint(0, &pid) < 0 || argint(1, &interval) < 0)
+    return -1;
+  return wsctl(pid, interval);
+}
+
+int
+sys_wsread(void)
+{
+  struct wsstat *st;
+  char *buf;
+  int n;
+
+  if(argint(2, &n) < 0 || n < 0 || argptrw(0, (void*)&st, sizeof(*st)) < 0 ||
+     argptrw(1, &buf, n) < 0)
+    return -1;
+  return wsread(st, (uchar*)buf, n);
+}
+
+int
+sys_rsslimit(void)
+{
+  int pid, pages;
+
+  if(argint(0, &pid) < 0 || argint(1, &pages) < 0)
+    return -1;
+  return setrsslimit(pid, pages);
+}
+
 int
 sys_getpid(void)
 {
@@ -70,6 +154,98 @@ sys_sbrk(void)
   return addr;
 }
 
+int
+sys_madvise(void)
+{
+  int addr, len, advice;
+
+  if(argint(0, &addr) < 0 || argint(1, &len) < 0 || argint(2, &advice) < 0)
+    return -1;
+  return madvise(addr, len, advice);
+}
+
+int
+sys_mlock(void)
+{
+  int addr, len;
+
+  if(argint(0, &addr) < 0 || argint(1, &len) < 0)
+    return -1;
+  return mlock(addr, len);
+}
+
+int
+sys_munlock(void)
+{
+  int addr, len;
+
+  if(argint(0, &addr) < 0 || argint(1, &len) < 0)
+    return -1;
+  return munlock(addr, len);
+}
+
+int
+sys_munmap(void)
+{
+  int addr, len;
+
+  if(argint(0, &addr) < 0 || argint(1, &len) < 0)
+    return -1;
+  return munmap(addr, len);
+}
+
+int
+sys_msync(void)
+{
+  int addr, len;
+
+  if(argint(0, &addr) < 0 || argint(1, &len) < 0)
+    return -1;
+  return msync(addr, len);
+}
+
+// shmget(name, size): size in bytes, rounded up to pages.
+int
+sys_shmget(void)
+{
+  char *name;
+  int size;
+
+  if(argstr(0, &name) < 0 || argint(1, &size) < 0 || size < 0)
+    return -1;
+  return shmget(name, PGROUNDUP(size) / PGSIZE);
+}
+
+int
+sys_shmat(void)
+{
+  int id;
+
+  if(argint(0, &id) < 0)
+    return -1;
+  return shmat(id);
+}
+
+int
+sys_shmdt(void)
+{
+  int addr;
+
+  if(argint(0, &addr) < 0)
+    return -1;
+  return shmdt(addr);
+}
+
+int
+sys_shmrm(void)
+{
+  int id;
+
+  if(argint(0, &id) < 0)
+    return -1;
+  return shmrm(id);
+}
+
 int
 sys_sleep(void)
 {
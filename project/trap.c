@@ -43,6 +43,8 @@ trap(struct trapframe *tf)
     syscall();
     if(myproc()->killed)
       exit();
+    if(myproc()->suspended)
+      loadwait();
     return;
   }
 
@@ -53,7 +55,18 @@ trap(struct trapframe *tf)
       ticks++;
       wakeup(&ticks);
       release(&tickslock);
+      polltick();
+      if(ticks % REPL_SAMPLE_TICKS == 0)
+        repl_sample();
+      if(ticks % THRASH_TICKS == 0)
+        loadcontrol();
     }
+    wstick();
+    lapiceoi();
+    break;
+  case T_TLBFLUSH:
+    lcr3(rcr3());
+    mycpu()->tlbflushes++;
     lapiceoi();
     break;
   case T_IRQ0 + IRQ_IDE:
@@ -115,4 +128,11 @@ trap(struct trapframe *tf)
   // Check if the process has been killed since we yielded
   if(myproc() && myproc()->killed && (tf->cs&3) == DPL_USER)
     exit();
+
+  // Park here if load control has suspended the process.
+  if(myproc() && myproc()->suspended && (tf->cs&3) == DPL_USER){
+    loadwait();
+    if(myproc()->killed)
+      exit();
+  }
 }
@@ -4,6 +4,61 @@
 #include "user.h"
 #include "x86.h"
 
+int _fork(void);
+int _exit(void) __attribute__((noreturn));
+int _exec(char*, char**);
+int _spawn(char*, char**, int*);
+int _close(int);
+
+// Run before a process exits, forks or execs; stdio.c sets it to
+// flush its buffers, so that output is neither lost nor written
+// twice.
+void (*_flushhook)(void);
+
+// Run before close(fd); stdio.c sets it to flush and forget the
+// stream on fd, so that it does not outlive the file.
+void (*_closehook)(int);
+
+int
+fork(void)
+{
+  if(_flushhook)
+    _flushhook();
+  return _fork();
+}
+
+int
+exit(void)
+{
+  if(_flushhook)
+    _flushhook();
+  _exit();
+}
+
+int
+exec(char *path, char **argv)
+{
+  if(_flushhook)
+    _flushhook();
+  return _exec(path, argv);
+}
+
+int
+spawn(char *path, char **argv, int *fdmap)
+{
+  if(_flushhook)
+    _flushhook();
+  return _spawn(path, argv, fdmap);
+}
+
+int
+close(int fd)
+{
+  if(_closehook)
+    _closehook(fd);
+  return _close(fd);
+}
+
 char*
 strcpy(char *s, const char *t)
 {
@@ -49,24 +104,6 @@ strchr(const char *s, char c)
   return 0;
 }
 
-char*
-gets(char *buf, int max)
-{
-  int i, cc;
-  char c;
-
-  for(i=0; i+1 < max; ){
-    cc = read(0, &c, 1);
-    if(cc < 1)
-      break;
-    buf[i++] = c;
-    if(c == '\n' || c == '\r')
-      break;
-  }
-  buf[i] = '\0';
-  return buf;
-}
-
 int
 stat(const char *n, struct stat *st)
 {
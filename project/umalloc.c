@@ -2,89 +2,266 @@
 #include "stat.h"
 #include "user.h"
 #include "param.h"
+#include "mmu.h"
+#include "memlayout.h"
+#include "mman.h"
 
-// Memory allocator by Kernighan and Ritchie,
-// The C programming Language, 2nd ed.  Section 8.7.
+// Memory allocator with segregated size classes.
+//
+// Requests of up to MAXSMALL bytes are rounded up to a power of
+// two and served from slabs: single pages that hold objects of one
+// class, with a struct slab at the start of the page.  Each class
+// keeps a list of its slabs that have free objects, so malloc()
+// and free() of small objects take constant time.  A slab whose
+// objects are all free goes back to the page pool, except the
+// last one of its class.
+//
+// Larger requests get a run of whole pages, also headed by a
+// struct slab, so free() finds the header of any block by
+// rounding its address down to a page.
+//
+// The page pool keeps free runs in address order, headed by a
+// struct run in their first page.  Runs are carved from the heap
+// with sbrk() only when no free run fits.  A free run at the top
+// of the heap is given back with sbrk(-n); the rest of a free run
+// is handed back with madvise(MADV_DONTNEED), so its frames are
+// freed and it comes back zeroed when touched again.
 
-typedef long Align;
+#define MINSHIFT  4                    // smallest class is 16 bytes
+#define NCLASS    7                    // 16 .. 1024 bytes
+#define MAXSMALL  (1 << (MINSHIFT+NCLASS-1))
+#define SLABMAGIC  0x51ab51ab
+#define LARGEMAGIC 0x1a46e1a4
 
-union header {
-  struct {
-    union header *ptr;
-    uint size;
-  } s;
-  Align x;
+struct slab {
+  uint magic;          // SLABMAGIC or LARGEMAGIC
+  uint size;           // object size, or pages in a large block
+  uint nfree;          // free objects
+  uint ntouched;       // objects handed out at least once
+  void *free;          // freed objects
+  struct slab *next;   // slabs of this class with free objects
+  struct slab *prev;
+  uint pad;
 };
 
-typedef union header Header;
+struct run {
+  uint npages;
+  struct run *next;
+};
 
-static Header base;
-static Header *freep;
+static struct slab *partial[NCLASS];
+static struct run *runs;           // free page runs, by address
+static struct mallocstat mstat;
 
-void
-free(void *ap)
+#define HDRSIZE   sizeof(struct slab)
+#define NOBJ(size) ((PGSIZE - HDRSIZE) / (size))
+
+// Give back the pages at p, which has just become the first page
+// of a free run, or an inner page of one if head is 0.
+static void
+release(char *p, uint npages, int head)
 {
-  Header *bp, *p;
-
-  bp = (Header*)ap - 1;
-  for(p = freep; !(bp > p && bp < p->s.ptr); p = p->s.ptr)
-    if(p >= p->s.ptr && (bp > p || bp < p->s.ptr))
-      break;
-  if(bp + bp->s.size == p->s.ptr){
-    bp->s.size += p->s.ptr->s.size;
-    bp->s.ptr = p->s.ptr->s.ptr;
-  } else
-    bp->s.ptr = p->s.ptr;
-  if(p + p->s.size == bp){
-    p->s.size += bp->s.size;
-    p->s.ptr = bp->s.ptr;
-  } else
-    p->s.ptr = bp;
-  freep = p;
+  if(head){
+    p += PGSIZE;
+    npages--;
+  }
+  if(npages > 0 && madvise(p, npages * PGSIZE, MADV_DONTNEED) == 0)
+    mstat.advised += npages * PGSIZE;
 }
 
-static Header*
-morecore(uint nu)
+// Return npages pages at p to the pool.
+static void
+putpages(char *p, uint npages)
 {
+  struct run *r, *prev, *nr, **pp;
+
+  mstat.cached += npages * PGSIZE;
+  prev = 0;
+  for(r = runs; r && (char*)r < p; r = r->next)
+    prev = r;
+
+  if(prev && (char*)prev + prev->npages * PGSIZE == p){
+    // Append to the run before.
+    release(p, npages, 0);
+    prev->npages += npages;
+    nr = prev;
+  } else {
+    release(p, npages, 1);
+    nr = (struct run*)p;
+    nr->npages = npages;
+    nr->next = r;
+    if(prev)
+      prev->next = nr;
+    else
+      runs = nr;
+  }
+  if(r && (char*)nr + nr->npages * PGSIZE == (char*)r){
+    // Absorb the run after; its first page is no longer a head.
+    nr->npages += r->npages;
+    nr->next = r->next;
+    release((char*)r, 1, 0);
+  }
+
+  // Shrink the heap if the run is at the top.
+  if(nr->next == 0 && (char*)nr + nr->npages * PGSIZE == sbrk(0)){
+    for(pp = &runs; *pp != nr; pp = &(*pp)->next)
+      ;
+    *pp = 0;
+    mstat.cached -= nr->npages * PGSIZE;
+    mstat.heap -= nr->npages * PGSIZE;
+    mstat.trimmed += nr->npages * PGSIZE;
+    sbrk(-(int)(nr->npages * PGSIZE));
+  }
+}
+
+// Take npages contiguous pages from the pool, growing the heap
+// if no free run is large enough.
+static char*
+getpages(uint npages)
+{
+  struct run *r, **pp;
   char *p;
-  Header *hp;
+  uint cur;
+
+  for(pp = &runs; (r = *pp) != 0; pp = &r->next){
+    if(r->npages < npages)
+      continue;
+    mstat.cached -= npages * PGSIZE;
+    if(r->npages == npages){
+      *pp = r->next;
+      return (char*)r;
+    }
+    // Split off the end, so the run keeps its head.
+    r->npages -= npages;
+    return (char*)r + r->npages * PGSIZE;
+  }
+
+  cur = (uint)sbrk(0);
+  if(cur % PGSIZE && sbrk(PGROUNDUP(cur) - cur) == (char*)-1)
+    return 0;
+  if((p = sbrk(npages * PGSIZE)) == (char*)-1)
+    return 0;
+  mstat.heap += npages * PGSIZE;
+  return p;
+}
+
+static void
+slabunlink(struct slab *s, int c)
+{
+  if(s->prev)
+    s->prev->next = s->next;
+  else
+    partial[c] = s->next;
+  if(s->next)
+    s->next->prev = s->prev;
+}
+
+static void
+slabpush(struct slab *s, int c)
+{
+  s->prev = 0;
+  s->next = partial[c];
+  if(s->next)
+    s->next->prev = s;
+  partial[c] = s;
+}
+
+static void*
+malloclarge(uint nbytes)
+{
+  struct slab *s;
+  uint npages;
 
-  if(nu < 4096)
-    nu = 4096;
-  p = sbrk(nu * sizeof(Header));
-  if(p == (char*)-1)
+  if(nbytes > MMAPBASE)
     return 0;
-  hp = (Header*)p;
-  hp->s.size = nu;
-  free((void*)(hp + 1));
-  return freep;
+  npages = PGROUNDUP(nbytes + HDRSIZE) / PGSIZE;
+  if((s = (struct slab*)getpages(npages)) == 0)
+    return 0;
+  s->magic = LARGEMAGIC;
+  s->size = npages;
+  mstat.large += npages * PGSIZE;
+  return s + 1;
 }
 
 void*
 malloc(uint nbytes)
 {
-  Header *p, *prevp;
-  uint nunits;
+  struct slab *s;
+  void *p;
+  int c;
 
-  nunits = (nbytes + sizeof(Header) - 1)/sizeof(Header) + 1;
-  if((prevp = freep) == 0){
-    base.s.ptr = freep = prevp = &base;
-    base.s.size = 0;
+  mstat.nmalloc++;
+  if(nbytes > MAXSMALL)
+    return malloclarge(nbytes);
+  for(c = 0; (1 << (MINSHIFT+c)) < nbytes; c++)
+    ;
+  if((s = partial[c]) == 0){
+    if((s = (struct slab*)getpages(1)) == 0)
+      return 0;
+    s->magic = SLABMAGIC;
+    s->size = 1 << (MINSHIFT+c);
+    s->nfree = NOBJ(s->size);
+    s->ntouched = 0;
+    s->free = 0;
+    slabpush(s, c);
+    mstat.slabs += PGSIZE;
   }
-  for(p = prevp->s.ptr; ; prevp = p, p = p->s.ptr){
-    if(p->s.size >= nunits){
-      if(p->s.size == nunits)
-        prevp->s.ptr = p->s.ptr;
-      else {
-        p->s.size -= nunits;
-        p += p->s.size;
-        p->s.size = nunits;
-      }
-      freep = prevp;
-      return (void*)(p + 1);
-    }
-    if(p == freep)
-      if((p = morecore(nunits)) == 0)
-        return 0;
+
+  if(s->free){
+    p = s->free;
+    s->free = *(void**)p;
+  } else {
+    // Objects are handed out in order the first time, so pages
+    // of a new slab are only touched as they are needed.
+    p = (char*)(s + 1) + s->ntouched * s->size;
+    s->ntouched++;
   }
+  if(--s->nfree == 0)
+    slabunlink(s, c);
+  mstat.inuse += s->size;
+  return p;
+}
+
+void
+free(void *ap)
+{
+  struct slab *s;
+  int c;
+
+  if(ap == 0)
+    return;
+  mstat.nfree++;
+  s = (struct slab*)PGROUNDDOWN((uint)ap);
+  if(s->magic == LARGEMAGIC){
+    mstat.large -= s->size * PGSIZE;
+    s->magic = 0;
+    putpages((char*)s, s->size);
+    return;
+  }
+  if(s->magic != SLABMAGIC){
+    printf(2, "free: bad pointer %p\n", ap);
+    exit();
+  }
+
+  for(c = 0; (1 << (MINSHIFT+c)) < s->size; c++)
+    ;
+  mstat.inuse -= s->size;
+  *(void**)ap = s->free;
+  s->free = ap;
+  if(s->nfree++ == 0)
+    slabpush(s, c);
+  if(s->nfree == NOBJ(s->size) && (s->prev || s->next)){
+    // Empty, and not the only slab of its class with room.
+    slabunlink(s, c);
+    s->magic = 0;
+    mstat.slabs -= PGSIZE;
+    putpages((char*)s, 1);
+  }
+}
+
+// Fill in *st with the allocator's counters.
+void
+mallocstat(struct mallocstat *st)
+{
+  *st = mstat;
 }
@@ -1,5 +1,21 @@
 struct stat;
 struct rtcdate;
+struct replstat;
+struct wsstat;
+struct pollfd;
+
+// Counters kept by malloc(); see umalloc.c.
+struct mallocstat {
+  uint heap;      // bytes of heap taken with sbrk() and not given back
+  uint slabs;     // bytes of slab pages
+  uint inuse;     // bytes of allocated small objects, rounded to class
+  uint large;     // bytes of pages in large blocks
+  uint cached;    // bytes of free pages kept in the pool
+  uint advised;   // bytes handed back with madvise()
+  uint trimmed;   // bytes handed back with sbrk(-n)
+  uint nmalloc;   // calls to malloc()
+  uint nfree;     // calls to free()
+};
 
 // system calls
 int fork(void);
@@ -25,6 +41,28 @@ int sleep(int);
 int uptime(void);
 int getrss(void);
 int getNumFreePages(void);
+int spawn(char*, char**, int*);
+int oomadj(int, int);
+int overcommit(int);
+int replpolicy(int);
+int replstat(int, struct replstat*);
+int wsctl(int, int);
+int wsread(struct wsstat*, uchar*, int);
+int rsslimit(int, int);
+int madvise(void*, uint, int);
+int mlock(void*, uint);
+int munlock(void*, uint);
+void* mmap(void*, uint, int, int, int, uint);
+int munmap(void*, uint);
+int msync(void*, uint);
+int shmget(char*, uint);
+void* shmat(int);
+int shmdt(void*);
+int shmrm(int);
+int splice(int, int, int);
+int fcntl(int, int, int);
+int poll(struct pollfd*, int, int);
+int bcachesize(void);
 
 // ulib.c
 int stat(const char*, struct stat*);
@@ -33,9 +71,46 @@ void *memmove(void*, const void*, int);
 char* strchr(const char*, char c);
 int strcmp(const char*, const char*);
 void printf(int, const char*, ...);
-char* gets(char*, int max);
 uint strlen(const char*);
 void* memset(void*, int, uint);
 void* malloc(uint);
 void free(void*);
+void mallocstat(struct mallocstat*);
 int atoi(const char*);
+
+// stdio.c
+#define EOF     (-1)
+#define BUFSIZ  1024
+#define _IOFBF  0  // full buffering
+#define _IOLBF  1  // line buffering: flush at each newline
+#define _IONBF  2  // no buffering
+
+// A buffered stream on a file descriptor; see stdio.c.
+typedef struct {
+  int fd;
+  int mode;       // _IOFBF, _IOLBF or _IONBF
+  char *buf;      // 0 until first use
+  int size;       // size of buf
+  int rpos;       // reading: next byte in buf
+  int rend;       // reading: end of the data in buf
+  int wpos;       // writing: bytes waiting in buf
+  int eof;        // a read returned end of file
+  int err;        // a read or write failed
+  int flags;
+  char ch;        // buf when unbuffered
+} FILE;
+
+FILE* fdopen(int);
+int fclose(FILE*);
+int fflush(FILE*);
+int setvbuf(FILE*, char*, int, int);
+int fgetc(FILE*);
+char* fgets(char*, int, FILE*);
+char* gets(char*, int max);
+int fputc(int, FILE*);
+int fputs(const char*, FILE*);
+int fread(void*, int, int, FILE*);
+int fwrite(const void*, int, int, FILE*);
+int feof(FILE*);
+int ferror(FILE*);
+void fprintf(FILE*, const char*, ...);
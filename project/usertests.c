@@ -7,6 +7,7 @@
 #include "syscall.h"
 #include "traps.h"
 #include "memlayout.h"
+#include "poll.h"
 
 char buf[8192];
 char name[3];
@@ -300,6 +301,44 @@ exectest(void)
   }
 }
 
+// spawn a child directly from an ELF, with its stdout
+// remapped onto a pipe.
+void
+spawntest(void)
+{
+  int fds[2], fdmap[NOFILE], i, n, pid;
+  char buf[32];
+
+  printf(stdout, "spawn test\n");
+  if(pipe(fds) != 0){
+    printf(stdout, "pipe() failed\n");
+    exit();
+  }
+  for(i = 0; i < NOFILE; i++)
+    fdmap[i] = -1;
+  fdmap[1] = fds[1];
+  pid = spawn("echo", echoargv, fdmap);
+  if(pid < 0){
+    printf(stdout, "spawn echo failed\n");
+    exit();
+  }
+  close(fds[1]);
+  n = 0;
+  while((i = read(fds[0], buf + n, sizeof(buf) - 1 - n)) > 0)
+    n += i;
+  buf[n] = 0;
+  close(fds[0]);
+  if(wait() != pid || strcmp(buf, "ALL TESTS PASSED\n") != 0){
+    printf(stdout, "spawn echo wrong output %s\n", buf);
+    exit();
+  }
+  if(spawn("nonexistent", echoargv, 0) >= 0){
+    printf(stdout, "spawn nonexistent succeeded!\n");
+    exit();
+  }
+  printf(stdout, "spawn test ok\n");
+}
+
 // simple fork and pipe read/write
 
 void
@@ -354,6 +393,65 @@ pipe1(void)
   printf(1, "pipe1 ok\n");
 }
 
+// poll() on two pipes, with and without a timeout, and
+// O_NONBLOCK reads and writes.
+void
+polltest(void)
+{
+  int a[2], b[2], pid, n;
+  struct pollfd pfd[2];
+
+  printf(1, "poll test\n");
+  if(pipe(a) != 0 || pipe(b) != 0){
+    printf(1, "pipe() failed\n");
+    exit();
+  }
+  pfd[0].fd = a[0];
+  pfd[0].events = POLLIN;
+  pfd[1].fd = b[0];
+  pfd[1].events = POLLIN;
+  if(poll(pfd, 2, 2) != 0){
+    printf(1, "poll: empty pipes ready\n");
+    exit();
+  }
+  fcntl(b[0], F_SETFL, O_NONBLOCK);
+  if(read(b[0], buf, 1) != -1){
+    printf(1, "poll: non-blocking read blocked or read data\n");
+    exit();
+  }
+  pid = fork();
+  if(pid == 0){
+    sleep(5);
+    write(b[1], "x", 1);
+    exit();
+  }
+  if(poll(pfd, 2, -1) != 1 || pfd[0].revents || pfd[1].revents != POLLIN ||
+     read(b[0], buf, sizeof(buf)) != 1){
+    printf(1, "poll: wrong pipe ready\n");
+    exit();
+  }
+  wait();
+
+  fcntl(a[1], F_SETFL, O_NONBLOCK);
+  for(n = 0; write(a[1], buf, sizeof(buf)) > 0; n++)
+    ;
+  pfd[0].fd = a[1];
+  pfd[0].events = POLLOUT;
+  if(n == 0 || poll(pfd, 1, 0) != 0){
+    printf(1, "poll: full pipe writable\n");
+    exit();
+  }
+  close(b[1]);
+  if(poll(pfd + 1, 1, 0) != 1 || pfd[1].revents != POLLHUP){
+    printf(1, "poll: no hangup\n");
+    exit();
+  }
+  close(a[0]);
+  close(a[1]);
+  close(b[0]);
+  printf(1, "poll test ok\n");
+}
+
 // meant to be run w/ at most two CPUs
 void
 preempt(void)
@@ -1411,6 +1509,41 @@ forktest(void)
   printf(1, "fork test OK\n");
 }
 
+// in strict overcommit mode, a request that RAM plus swap
+// can't back must fail at sbrk rather than in the fault path.
+void
+overcommittest(void)
+{
+  int old, pid;
+  char *a;
+
+  printf(stdout, "overcommit test\n");
+  old = overcommit(OVERCOMMIT_NEVER);
+  if(old < 0){
+    printf(stdout, "overcommit mode not accepted\n");
+    exit();
+  }
+  a = sbrk(64*1024*1024);
+  if(a != (char*)-1){
+    printf(stdout, "strict sbrk of 64MB succeeded\n");
+    exit();
+  }
+  pid = fork();
+  if(pid < 0){
+    printf(stdout, "strict fork failed\n");
+    exit();
+  }
+  if(pid == 0)
+    exit();
+  wait();
+  overcommit(old);
+  if(overcommit(-1) != -1){
+    printf(stdout, "bad overcommit mode accepted\n");
+    exit();
+  }
+  printf(stdout, "overcommit test ok\n");
+}
+
 void
 sbrktest(void)
 {
@@ -1768,6 +1901,7 @@ main(int argc, char *argv[])
   bigargtest();
   bsstest();
   sbrktest();
+  overcommittest();
   validatetest();
 
   opentest();
@@ -1781,6 +1915,7 @@ main(int argc, char *argv[])
 
   mem();
   pipe1();
+  polltest();
   preempt();
   exitwait();
 
@@ -1797,6 +1932,7 @@ main(int argc, char *argv[])
 
   uio();
 
+  spawntest();
   exectest();
 
   exit();
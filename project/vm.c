@@ -5,7 +5,10 @@
 #include "memlayout.h"
 #include "mmu.h"
 #include "proc.h"
+#include "traps.h"
 #include "elf.h"
+#include "page.h"
+#include "mman.h"
 
 extern char data[];  // defined by kernel.ld
 pde_t *kpgdir;  // for use in scheduler()
@@ -56,12 +59,14 @@ walkpgdir(pde_t *pgdir, const void *va, int alloc)
 
 // Create PTEs for virtual addresses starting at va that refer to
 // physical addresses starting at pa. va and size might not
-// be page-aligned.
+// be page-aligned.  User mappings are recorded in the frame's
+// struct page so the owner can be found from the frame.
 static int
 mappages(pde_t *pgdir, void *va, uint size, uint pa, int perm)
 {
   char *a, *last;
   pte_t *pte;
+  struct page *pg;
 
   a = (char*)PGROUNDDOWN((uint)va);
   last = (char*)PGROUNDDOWN(((uint)va) + size - 1);
@@ -71,6 +76,12 @@ mappages(pde_t *pgdir, void *va, uint size, uint pa, int perm)
     if(*pte & PTE_P)
       panic("remap");
     *pte = pa | perm | PTE_P;
+    if((uint)a < KERNBASE){
+      pg = pa2page(pa);
+      pg->pgdir = pgdir;
+      pg->va = (uint)a;
+      repl_map(pg);
+    }
     if(a == last)
       break;
     a += PGSIZE;
@@ -79,6 +90,13 @@ mappages(pde_t *pgdir, void *va, uint size, uint pa, int perm)
   return 0;
 }
 
+// Map the page at kernel address mem at user address va.
+int
+mappage(pde_t *pgdir, uint va, char *mem, int perm)
+{
+  return mappages(pgdir, (char*)va, PGSIZE, V2P(mem), perm);
+}
+
 // There is one page table per process, plus one that's used when
 // a CPU is not running any process (kpgdir). The kernel uses the
 // current process's page table during system calls and interrupts;
@@ -177,6 +195,36 @@ switchuvm(struct proc *p)
   popcli();
 }
 
+// Make every CPU drop the TLB entries it may hold for pgdir, after
+// PTEs of pgdir were changed or cleared.  Only a CPU running a
+// process with that page table can hold any: the others load cr3
+// afresh when they switch to one.  Waits for the other CPUs to
+// reload cr3, so the caller must not hold a spinlock.
+void
+tlbflush(pde_t *pgdir)
+{
+  struct cpu *c, *me;
+  struct proc *p;
+  uint n;
+
+  if((readeflags() & FL_IF) == 0)
+    panic("tlbflush: interrupts off");
+  __sync_synchronize();   // the PTE stores before the looks at c->proc
+  pushcli();
+  me = mycpu();
+  if(me->proc && me->proc->pgdir == pgdir)
+    lcr3(V2P(pgdir));
+  popcli();
+  for(c = cpus; c < cpus+ncpu; c++){
+    if(c == me || (p = c->proc) == 0 || p->pgdir != pgdir)
+      continue;
+    n = c->tlbflushes;
+    lapicipi(c->apicid, T_TLBFLUSH);
+    while(c->tlbflushes == n)
+      ;
+  }
+}
+
 // Load the initcode into address 0 of pgdir.
 // sz must be less than a page.
 void
@@ -210,6 +258,7 @@ loaduvm(pde_t *pgdir, char *addr, struct inode *ip, uint offset, uint sz)
       n = sz - i;
     else
       n = PGSIZE;
+    ireadahead(ip, offset+i, READAHEAD);
     if(readi(ip, P2V(pa), offset+i, n) != n)
       return -1;
   }
@@ -251,7 +300,8 @@ allocuvm(pde_t *pgdir, uint oldsz, uint newsz)
 // Deallocate user pages to bring the process size from oldsz to
 // newsz.  oldsz and newsz need not be page-aligned, nor does newsz
 // need to be less than oldsz.  oldsz can be larger than the actual
-// process size.  Returns the new process size.
+// process size.  Swapped-out pages release their swap slots.
+// Returns the new process size.
 int
 deallocuvm(pde_t *pgdir, uint oldsz, uint newsz)
 {
@@ -273,11 +323,39 @@ deallocuvm(pde_t *pgdir, uint oldsz, uint newsz)
       char *v = P2V(pa);
       kfree(v);
       *pte = 0;
+    } else if(*pte & 0x008){
+      // Swapped out: give the swap slot back.
+      freepage(pte);
+      *pte = 0;
     }
   }
   return newsz;
 }
 
+// Count the user memory between oldsz and newsz (rounded as in
+// deallocuvm) that is resident in *rssp and swapped out in *swapp,
+// both in bytes.  Used to keep p->rss and p->swapsz exact when
+// deallocuvm frees part of an address space.
+void
+countuvm(pde_t *pgdir, uint newsz, uint oldsz, uint *rssp, uint *swapp)
+{
+  pte_t *pte;
+  uint a;
+
+  *rssp = 0;
+  *swapp = 0;
+  a = PGROUNDUP(newsz);
+  for(; a < oldsz; a += PGSIZE){
+    pte = walkpgdir(pgdir, (char*)a, 0);
+    if(!pte)
+      a = PGADDR(PDX(a) + 1, 0, 0) - PGSIZE;
+    else if(*pte & PTE_P)
+      *rssp += PGSIZE;
+    else if(*pte & 0x008)
+      *swapp += PGSIZE;
+  }
+}
+
 // Free a page table and all the physical memory pages
 // in the user part.
 void
@@ -323,15 +401,26 @@ copyuvm(pde_t *pgdir, uint sz)
   if((d = setupkvm()) == 0)
     return 0;
   for(i = 0; i < sz; i += PGSIZE){
+    // Allocate first: kalloc() may push this very page out to swap.
+    if((mem = kalloc()) == 0)
+      goto bad;
     if((pte = walkpgdir(pgdir, (void *) i, 0)) == 0)
       panic("copyuvm: pte should exist");
-    if(!(*pte & PTE_P))
+    if(*pte == 0){
+      // Dropped by madvise(); the child faults in zeros too.
+      kfree(mem);
+      continue;
+    }
+    if(*pte & PTE_P){
+      pa = PTE_ADDR(*pte);
+      flags = PTE_FLAGS(*pte);
+      memmove(mem, (char*)P2V(pa), PGSIZE);
+    } else if(*pte & 0x008)
+      flags = swap_read(*pte, mem);
+    else
       panic("copyuvm: page not present");
-    pa = PTE_ADDR(*pte);
-    flags = PTE_FLAGS(*pte);
-    if((mem = kalloc()) == 0)
-      goto bad;
-    memmove(mem, (char*)P2V(pa), PGSIZE);
+    if(flags & PTE_COW)
+      flags = (flags & ~PTE_COW) | PTE_W;   // the copy is private
     if(mappages(d, (void*)i, PGSIZE, V2P(mem), flags) < 0) {
       kfree(mem);
       goto bad;
@@ -344,6 +433,215 @@ bad:
   return 0;
 }
 
+// Advise the kernel how the current process will use the pages
+// in [addr, addr+len).  addr must be page aligned.
+//   MADV_DONTNEED    free the pages and their swap slots now; they
+//                    read back as zero-filled pages
+//   MADV_WILLNEED    swap the pages back in while free memory lasts
+//   MADV_SEQUENTIAL  read ahead on swap-in faults and drop pages
+//                    behind the fault (see page_fault_handler)
+//   MADV_RANDOM, MADV_NORMAL
+//                    neither; they replace a SEQUENTIAL hint
+// A process keeps one SEQUENTIAL/RANDOM range, the latest given.
+int
+madvise(uint addr, uint len, int advice)
+{
+  struct proc *p = myproc();
+  pte_t *pte;
+  uint a, end;
+
+  if(addr % PGSIZE || addr + len < addr || addr + len > p->sz)
+    return -1;
+  end = PGROUNDUP(addr + len);
+  switch(advice){
+  case MADV_NORMAL:
+  case MADV_RANDOM:
+  case MADV_SEQUENTIAL:
+    p->advice = advice;
+    p->advstart = addr;
+    p->advend = end;
+    return 0;
+
+  case MADV_WILLNEED:
+    swap_prefetch(p, addr, (end - addr) / PGSIZE);
+    return 0;
+
+  case MADV_DONTNEED:
+    // Like Linux, refuse to drop mlock()ed pages.
+    for(a = addr; a < end; a += PGSIZE){
+      pte = walkpgdir(p->pgdir, (char*)a, 0);
+      if(pte && (*pte & PTE_P) && (*pte & PTE_U) &&
+         (pa2page(PTE_ADDR(*pte))->flags & PG_PINNED))
+        return -1;
+    }
+    for(a = addr; a < end; a += PGSIZE){
+      pte = walkpgdir(p->pgdir, (char*)a, 0);
+      if(!pte){
+        a = PGADDR(PDX(a) + 1, 0, 0) - PGSIZE;
+        continue;
+      }
+      if(*pte & PTE_P){
+        if((*pte & PTE_U) == 0)
+          continue;    // stack guard page
+        kfree(P2V(PTE_ADDR(*pte)));
+        p->rss -= PGSIZE;
+      } else if(*pte & 0x008){
+        freepage(pte);
+        p->swapsz -= PGSIZE;
+      }
+      *pte = 0;
+    }
+    lcr3(V2P(p->pgdir));
+    return 0;
+  }
+  return -1;
+}
+
+// Lock the pages of the current process that overlap
+// [addr, addr+len) into memory, swapping them in first as needed.
+// A process may have at most MLOCK_LIMIT pages locked.  Locks are
+// not inherited by fork and go away with the address space.
+int
+mlock(uint addr, uint len)
+{
+  struct proc *p = myproc();
+  struct page *pg;
+  pte_t *pte;
+  uint a, start, end, n;
+
+  if(addr + len < addr || addr + len > p->sz)
+    return -1;
+  start = PGROUNDDOWN(addr);
+  end = PGROUNDUP(addr + len);
+
+  // Count the pages that would be locked afterwards.
+  n = 0;
+  for(a = 0; a < p->sz; a += PGSIZE){
+    if(a >= start && a < end){
+      n++;
+      continue;
+    }
+    pte = walkpgdir(p->pgdir, (char*)a, 0);
+    if(pte && (*pte & PTE_P) && (pa2page(PTE_ADDR(*pte))->flags & PG_PINNED))
+      n++;
+  }
+  if(n > MLOCK_LIMIT)
+    return -1;
+
+  for(a = start; a < end; ){
+    pte = walkpgdir(p->pgdir, (char*)a, 0);
+    if(pte && (*pte & PTE_P) && (*pte & PTE_COW)){
+      if(cowfault(a) < 0)    // loaned pages cannot be pinned
+        return -1;
+    } else if(pte && (*pte & PTE_P)){
+      pg = pa2page(PTE_ADDR(*pte));
+      if((*pte & PTE_U) == 0 || repl_pin(pg))
+        a += PGSIZE;
+      else
+        yield();    // being swapped out; look again when it is
+    } else if(pte && (*pte & 0x008)){
+      if(swap_page_in(pte, p, a) < 0)
+        return -1;
+    } else {
+      if(allocuvm(p->pgdir, a, a + PGSIZE) == 0)
+        return -1;
+      p->rss += PGSIZE;
+    }
+  }
+  return 0;
+}
+
+// Unlock the pages of the current process that overlap
+// [addr, addr+len).
+int
+munlock(uint addr, uint len)
+{
+  struct proc *p = myproc();
+  pte_t *pte;
+  uint a;
+
+  if(addr + len < addr || addr + len > p->sz)
+    return -1;
+  for(a = PGROUNDDOWN(addr); a < addr + len; a += PGSIZE){
+    pte = walkpgdir(p->pgdir, (char*)a, 0);
+    if(pte && (*pte & PTE_P) && (*pte & PTE_U))
+      repl_unpin(pa2page(PTE_ADDR(*pte)));
+  }
+  return 0;
+}
+
+// Loan the user page at va of the current process to the kernel
+// (see pipewrite): take a reference to its frame and make the
+// mapping copy-on-write, so the owner cannot change the data while
+// the kernel holds it.  A loaned frame is not evictable, so it is
+// taken away from the replacement policy until cowfault() gives
+// it back.  Returns the frame, or 0 if the page cannot be loaned:
+// not resident, read-only, locked, or shared memory.
+char*
+uvmloan(uint va)
+{
+  struct proc *p = myproc();
+  struct page *pg;
+  pte_t *pte;
+  char *mem;
+
+  if(va % PGSIZE || va >= p->sz)
+    return 0;
+  pte = walkpgdir(p->pgdir, (char*)va, 0);
+  if(pte == 0 || (*pte & (PTE_P|PTE_U|PTE_W)) != (PTE_P|PTE_U|PTE_W))
+    return 0;
+  pg = pa2page(PTE_ADDR(*pte));
+  if(pg->flags & (PG_PINNED|PG_SHM))
+    return 0;
+  mem = P2V(PTE_ADDR(*pte));
+  kdup(mem);
+  repl_unmap(pg);
+  *pte = (*pte & ~PTE_W) | PTE_COW;
+  lcr3(V2P(p->pgdir));
+  return mem;
+}
+
+// Write fault on the copy-on-write page at va of the current
+// process.  If the frame is no longer shared it is simply made
+// writable again; otherwise the process gets a copy.
+// Returns -1 if there is no memory for the copy.
+int
+cowfault(uint va)
+{
+  struct proc *p = myproc();
+  struct page *pg;
+  pte_t *pte;
+  char *mem;
+  uint pa, flags;
+
+  va = PGROUNDDOWN(va);
+  pte = walkpgdir(p->pgdir, (char*)va, 0);
+  pg = pa2page(PTE_ADDR(*pte));
+  if(pg->refcnt == 1){
+    *pte = (*pte & ~PTE_COW) | PTE_W;
+    repl_map(pg);
+    lcr3(V2P(p->pgdir));
+    return 0;
+  }
+
+  if((mem = kalloc()) == 0)
+    return -1;
+  // kalloc() may have slept; the page may be ours alone by now.
+  if(pg->refcnt == 1){
+    kfree(mem);
+    return cowfault(va);
+  }
+  pa = PTE_ADDR(*pte);
+  memmove(mem, P2V(pa), PGSIZE);
+  flags = (PTE_FLAGS(*pte) & ~PTE_COW) | PTE_W;
+  *pte = 0;
+  if(mappages(p->pgdir, (char*)va, PGSIZE, V2P(mem), flags) < 0)
+    panic("cowfault");
+  kfree(P2V(pa));      // the loan's reference is left
+  lcr3(V2P(p->pgdir));
+  return 0;
+}
+
 //PAGEBREAK!
 // Map user virtual address to kernel address.
 char*
@@ -0,0 +1,507 @@
+// Tests for the virtual memory system calls: RSS limits,
+// madvise, mlock, mmap, shared memory, pipe page loaning, pipe
+// buffer sizes, malloc and the buffer cache.  Kept out of usertests
+// so that binary stays within MAXFILE.
+
+#include "param.h"
+#include "types.h"
+#include "user.h"
+#include "fcntl.h"
+#include "mman.h"
+
+int stdout = 1;
+
+// A process under an RSS limit must page against itself, stay
+// within the limit and still see all of its memory.
+void
+rsslimittest(void)
+{
+  char *a;
+  int i, pid;
+
+  printf(stdout, "rsslimit test\n");
+  pid = fork();
+  if(pid < 0){
+    printf(stdout, "rsslimit fork failed\n");
+    exit();
+  }
+  if(pid == 0){
+    if(rsslimit(0, 16) != 0){
+      printf(stdout, "rsslimit not set\n");
+      exit();
+    }
+    a = sbrk(64*4096);
+    if(a == (char*)-1){
+      printf(stdout, "rsslimit sbrk failed\n");
+      exit();
+    }
+    for(i = 0; i < 64; i++)
+      a[i*4096] = i;
+    if((i = getrss()) > 16){
+      printf(stdout, "rsslimit exceeded: %d pages\n", i);
+      exit();
+    }
+    for(i = 0; i < 64; i++){
+      if(a[i*4096] != i){
+        printf(stdout, "rsslimit page %d lost\n", i);
+        exit();
+      }
+    }
+    if((i = getrss()) > 16){
+      printf(stdout, "rsslimit exceeded after swap-in: %d pages\n", i);
+      exit();
+    }
+    if(rsslimit(0, -1) != 16){
+      printf(stdout, "rsslimit query failed\n");
+      exit();
+    }
+    printf(stdout, "rsslimit test ok\n");
+    exit();
+  }
+  wait();
+}
+
+// madvise: DONTNEED pages come back zeroed, the rest are kept.
+void
+madvisetest(void)
+{
+  char *a;
+  int i;
+
+  printf(stdout, "madvise test\n");
+  a = sbrk(8*4096);
+  if(a == (char*)-1){
+    printf(stdout, "madvise sbrk failed\n");
+    exit();
+  }
+  for(i = 0; i < 8; i++)
+    a[i*4096] = 'x';
+  if(madvise(a + 2*4096, 4*4096, MADV_DONTNEED) < 0 ||
+     madvise(a, 8*4096, MADV_WILLNEED) < 0 ||
+     madvise(a, 8*4096, MADV_SEQUENTIAL) < 0){
+    printf(stdout, "madvise failed\n");
+    exit();
+  }
+  for(i = 0; i < 8; i++){
+    if(a[i*4096] != (i >= 2 && i < 6 ? 0 : 'x')){
+      printf(stdout, "madvise page %d wrong\n", i);
+      exit();
+    }
+  }
+  if(madvise(a + 1, 4096, MADV_DONTNEED) >= 0 || madvise(a, 4096, 99) >= 0){
+    printf(stdout, "madvise accepted bad arguments\n");
+    exit();
+  }
+  madvise(a, 8*4096, MADV_NORMAL);
+  sbrk(-8*4096);
+  printf(stdout, "madvise test ok\n");
+}
+
+// mlock: locked pages stay put, MADV_DONTNEED cannot drop them,
+// and the limit is enforced.
+void
+mlocktest(void)
+{
+  char *a, *b;
+  int i;
+
+  printf(stdout, "mlock test\n");
+  a = sbrk(4*4096);
+  if(a == (char*)-1){
+    printf(stdout, "mlock sbrk failed\n");
+    exit();
+  }
+  for(i = 0; i < 4; i++)
+    a[i*4096] = i;
+  if(mlock(a, 4*4096) < 0){
+    printf(stdout, "mlock failed\n");
+    exit();
+  }
+  for(i = 0; i < 4; i++){
+    if(a[i*4096] != i){
+      printf(stdout, "mlock page %d wrong\n", i);
+      exit();
+    }
+  }
+  if(madvise(a + 4096, 4096, MADV_DONTNEED) >= 0 || a[4096] != 1){
+    printf(stdout, "madvise dropped a locked page\n");
+    exit();
+  }
+  b = sbrk((MLOCK_LIMIT+1)*4096);
+  if(b == (char*)-1 || mlock(b, (MLOCK_LIMIT+1)*4096) >= 0){
+    printf(stdout, "mlock over the limit succeeded\n");
+    exit();
+  }
+  sbrk(-(MLOCK_LIMIT+1)*4096);
+  if(munlock(a, 4*4096) < 0){
+    printf(stdout, "munlock failed\n");
+    exit();
+  }
+  sbrk(-4*4096);
+  printf(stdout, "mlock test ok\n");
+}
+
+// mmap: anonymous memory, a shared file mapping written back by
+// munmap, sharing with a child across fork, including pages
+// neither had touched before the fork, and mapped memory as the
+// buffer of write() and read().
+void
+mmaptest(void)
+{
+  char *a, *b, buf[16];
+  int fd, fd1, i, pid;
+
+  printf(stdout, "mmap test\n");
+  a = mmap(0, 3*4096, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+  if(a == MAP_FAILED){
+    printf(stdout, "anonymous mmap failed\n");
+    exit();
+  }
+  for(i = 0; i < 3*4096; i += 512){
+    if(a[i] != 0){
+      printf(stdout, "anonymous mmap not zeroed\n");
+      exit();
+    }
+    a[i] = i / 512;
+  }
+  if(munmap(a + 4096, 4096) < 0 || a[0] != 0 || a[2*4096] != 16){
+    printf(stdout, "partial munmap failed\n");
+    exit();
+  }
+  munmap(a, 3*4096);
+
+  a = mmap(0, 2*4096, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_ANONYMOUS, -1, 0);
+  if(a == MAP_FAILED){
+    printf(stdout, "shared anonymous mmap failed\n");
+    exit();
+  }
+  pid = fork();
+  if(pid < 0){
+    printf(stdout, "mmap fork failed\n");
+    exit();
+  }
+  if(pid == 0){
+    a[4096] = 'c';
+    exit();
+  }
+  wait();
+  if(a[4096] != 'c'){
+    printf(stdout, "untouched shared page not shared with child\n");
+    exit();
+  }
+  munmap(a, 2*4096);
+
+  fd = open("mmapfile", O_CREATE|O_RDWR);
+  for(i = 0; i < 4096; i += sizeof(buf)){
+    memset(buf, 'a', sizeof(buf));
+    write(fd, buf, sizeof(buf));
+  }
+  a = mmap(0, 4096, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+  if(a == MAP_FAILED || a[0] != 'a' || a[4095] != 'a'){
+    printf(stdout, "file mmap failed\n");
+    exit();
+  }
+  pid = fork();
+  if(pid < 0){
+    printf(stdout, "mmap fork failed\n");
+    exit();
+  }
+  if(pid == 0){
+    a[1] = 'b';
+    exit();
+  }
+  wait();
+  a[0] = 'b';
+  if(a[1] != 'b'){
+    printf(stdout, "shared mapping not shared with child\n");
+    exit();
+  }
+  munmap(a, 4096);
+  close(fd);
+
+  fd = open("mmapfile", O_RDONLY);
+  if(read(fd, buf, 2) != 2 || buf[0] != 'b' || buf[1] != 'b'){
+    printf(stdout, "mmap writeback failed\n");
+    exit();
+  }
+
+  a = mmap(0, 4096, PROT_READ, MAP_PRIVATE, fd, 0);
+  fd1 = open("mmapcopy", O_CREATE|O_RDWR);
+  if(a == MAP_FAILED || fd1 < 0 || write(fd1, a, 4096) != 4096){
+    printf(stdout, "write from mmap failed\n");
+    exit();
+  }
+  close(fd1);
+  if((fd1 = open("mmapcopy", O_RDONLY)) < 0 || read(fd1, a, 16) != -1){
+    printf(stdout, "read into read-only mmap succeeded\n");
+    exit();
+  }
+  b = mmap(0, 4096, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+  if(b == MAP_FAILED || read(fd1, b, 4096) != 4096){
+    printf(stdout, "read into mmap failed\n");
+    exit();
+  }
+  for(i = 0; i < 4096; i++){
+    if(b[i] != a[i] || b[i] != (i < 2 ? 'b' : 'a')){
+      printf(stdout, "write/read through mmap corrupted data\n");
+      exit();
+    }
+  }
+  munmap(a, 4096);
+  munmap(b, 4096);
+  close(fd1);
+  unlink("mmapcopy");
+  close(fd);
+  unlink("mmapfile");
+  printf(stdout, "mmap test ok\n");
+}
+
+// shm: a segment found by name in an unrelated child is the
+// same memory as the parent's.
+void
+shmtest(void)
+{
+  char *a, *b;
+  int id, pid;
+
+  printf(stdout, "shm test\n");
+  id = shmget("shmtest", 2*4096);
+  if(id < 0 || (a = shmat(id)) == (char*)-1){
+    printf(stdout, "shmget/shmat failed\n");
+    exit();
+  }
+  a[0] = 'p';
+  pid = fork();
+  if(pid < 0){
+    printf(stdout, "shm fork failed\n");
+    exit();
+  }
+  if(pid == 0){
+    // Attach again by name, as an unrelated process would.
+    if((id = shmget("shmtest", 0)) < 0 || (b = shmat(id)) == (char*)-1){
+      printf(stdout, "shm attach by name failed\n");
+      exit();
+    }
+    if(b[0] != 'p'){
+      printf(stdout, "shm child sees wrong data\n");
+      exit();
+    }
+    b[4096] = 'c';
+    shmdt(b);
+    exit();
+  }
+  wait();
+  if(a[4096] != 'c'){
+    printf(stdout, "shm parent does not see child's write\n");
+    exit();
+  }
+  if(shmdt(a) < 0 || shmrm(id) < 0 || shmdt(a) >= 0){
+    printf(stdout, "shmdt/shmrm failed\n");
+    exit();
+  }
+  printf(stdout, "shm test ok\n");
+}
+
+// Pages written to a pipe are loaned, not copied: the writer must
+// be able to change them at once without the reader noticing.
+// splice() moves file data through a pipe.
+void
+splicetest(void)
+{
+  char *a, *b;
+  int fds[2], fd, i, n;
+
+  printf(stdout, "splice test\n");
+  a = sbrk(3*4096);
+  a += 4096 - (uint)a % 4096;
+  b = sbrk(2*4096);
+  memset(a, 'x', 2*4096);
+  if(pipe(fds) < 0 || write(fds[1], a, 2*4096) != 2*4096){
+    printf(stdout, "pipe write failed\n");
+    exit();
+  }
+  memset(a, 'y', 2*4096);
+  for(n = 0; n < 2*4096; n += i)
+    if((i = read(fds[0], b + n, 2*4096 - n)) <= 0)
+      break;
+  for(i = 0; i < n; i++)
+    if(b[i] != 'x')
+      break;
+  if(n != 2*4096 || i != n){
+    printf(stdout, "loaned pages changed under the reader\n");
+    exit();
+  }
+
+  fd = open("splicef", O_CREATE|O_RDWR);
+  for(i = 0; i < 5000; i++)
+    a[i] = 'a' + i % 26;
+  if(fd < 0 || write(fd, a, 5000) != 5000){
+    printf(stdout, "splice file create failed\n");
+    exit();
+  }
+  close(fd);
+  fd = open("splicef", O_RDONLY);
+  if(splice(fd, fds[1], 5000) != 5000){
+    printf(stdout, "splice file to pipe failed\n");
+    exit();
+  }
+  close(fd);
+  fd = open("splicef2", O_CREATE|O_RDWR);
+  for(n = 0; n < 5000; n += i)
+    if((i = splice(fds[0], fd, 5000 - n)) <= 0)
+      break;
+  close(fd);
+  fd = open("splicef2", O_RDONLY);
+  if(n != 5000 || read(fd, b, 2*4096) != 5000){
+    printf(stdout, "splice pipe to file failed\n");
+    exit();
+  }
+  for(i = 0; i < 5000; i++)
+    if(b[i] != 'a' + i % 26){
+      printf(stdout, "splice data wrong\n");
+      exit();
+    }
+  close(fd);
+  close(fds[0]);
+  close(fds[1]);
+  unlink("splicef");
+  unlink("splicef2");
+  printf(stdout, "splice test ok\n");
+}
+
+// A pipe can be resized to more than a page, though not below
+// the data it holds, and bytes and loaned pages come out in the
+// order they went in.
+void
+pipesizetest(void)
+{
+  char *a, *b;
+  int fds[2], i, n;
+
+  printf(stdout, "pipesize test\n");
+  a = sbrk(5*4096);
+  b = sbrk(5*4096);
+  if(pipe(fds) < 0 || fcntl(fds[0], F_GETPIPE_SZ, 0) != 4096 ||
+     fcntl(fds[1], F_SETPIPE_SZ, 10000) != 4*4096){
+    printf(stdout, "pipe resize failed\n");
+    exit();
+  }
+  for(i = 0; i < 16000; i++)
+    a[i] = i % 251;
+  if(write(fds[1], a + 1, 5000) != 5000 ||
+     fcntl(fds[1], F_SETPIPE_SZ, 0) >= 0 ||
+     write(fds[1], a + 5001, 16000 - 5001) != 16000 - 5001){
+    printf(stdout, "pipe write failed\n");
+    exit();
+  }
+  close(fds[1]);
+  for(n = 0; n < 16000; n += i)
+    if((i = read(fds[0], b + n, 16000 - n)) <= 0)
+      break;
+  for(i = 0; i < n; i++)
+    if(b[i] != (char)((i + 1) % 251))
+      break;
+  if(n != 16000 - 1 || i != n){
+    printf(stdout, "pipe data wrong\n");
+    exit();
+  }
+  close(fds[0]);
+  sbrk(-10*4096);
+  printf(stdout, "pipesize test ok\n");
+}
+
+// Small objects of every class must not overlap and must all be
+// accounted for; freeing a large block at the top of the heap must
+// shrink the heap again.
+void
+malloctest(void)
+{
+  char *p[64], *top, *big;
+  struct mallocstat st;
+  int i, j, n;
+
+  printf(stdout, "malloc test\n");
+  for(i = 0; i < 64; i++){
+    n = 1 + (i * 37) % 1024;
+    if((p[i] = malloc(n)) == 0){
+      printf(stdout, "malloc failed\n");
+      exit();
+    }
+    memset(p[i], i, n);
+  }
+  for(i = 0; i < 64; i++){
+    n = 1 + (i * 37) % 1024;
+    for(j = 0; j < n; j++)
+      if(p[i][j] != i){
+        printf(stdout, "malloc blocks overlap\n");
+        exit();
+      }
+    free(p[i]);
+  }
+  mallocstat(&st);
+  if(st.inuse != 0){
+    printf(stdout, "malloc leaked %d bytes\n", st.inuse);
+    exit();
+  }
+
+  top = sbrk(0);
+  big = malloc(40*1024);
+  memset(big, 1, 40*1024);
+  free(big);
+  mallocstat(&st);
+  if(sbrk(0) > top + 4096 || st.large != 0 || st.trimmed == 0){
+    printf(stdout, "malloc did not give memory back\n");
+    exit();
+  }
+  printf(stdout, "malloc test ok\n");
+}
+
+// bcache: under memory pressure the buffer cache gives pages back
+// before anything is swapped out.
+void
+bcachetest(void)
+{
+  char *a, buf[512];
+  int fd, i, n, before;
+
+  printf(stdout, "bcache test\n");
+  // Touch enough blocks to grow the cache to its full size.
+  fd = open("bcachefile", O_CREATE|O_RDWR);
+  memset(buf, 'b', sizeof(buf));
+  for(i = 0; i < 256; i++)
+    write(fd, buf, sizeof(buf));
+  close(fd);
+  unlink("bcachefile");
+
+  before = bcachesize();
+  n = getNumFreePages() + 16;
+  if((a = sbrk(n*4096)) == (char*)-1){
+    printf(stdout, "sbrk failed\n");
+    exit();
+  }
+  for(i = 0; i < n; i++)
+    a[i*4096] = 1;
+  if(bcachesize() >= before){
+    printf(stdout, "buffer cache did not shrink: %d pages\n", before);
+    exit();
+  }
+  sbrk(-n*4096);
+  printf(stdout, "bcache test ok\n");
+}
+
+int
+main(int argc, char *argv[])
+{
+  printf(1, "vmtests starting\n");
+  rsslimittest();
+  madvisetest();
+  mlocktest();
+  mmaptest();
+  shmtest();
+  splicetest();
+  pipesizetest();
+  malloctest();
+  bcachetest();
+  printf(1, "vmtests ok\n");
+  exit();
+}
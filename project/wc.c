@@ -2,30 +2,26 @@
 #include "stat.h"
 #include "user.h"
 
-char buf[512];
-
 void
-wc(int fd, char *name)
+wc(FILE *f, char *name)
 {
-  int i, n;
+  int ch;
   int l, w, c, inword;
 
   l = w = c = 0;
   inword = 0;
-  while((n = read(fd, buf, sizeof(buf))) > 0){
-    for(i=0; i<n; i++){
-      c++;
-      if(buf[i] == '\n')
-        l++;
-      if(strchr(" \r\t\n\v", buf[i]))
-        inword = 0;
-      else if(!inword){
-        w++;
-        inword = 1;
-      }
+  while((ch = fgetc(f)) != EOF){
+    c++;
+    if(ch == '\n')
+      l++;
+    if(strchr(" \r\t\n\v", ch))
+      inword = 0;
+    else if(!inword){
+      w++;
+      inword = 1;
     }
   }
-  if(n < 0){
+  if(ferror(f)){
     printf(1, "wc: read error\n");
     exit();
   }
@@ -38,7 +34,7 @@ main(int argc, char *argv[])
   int fd, i;
 
   if(argc <= 1){
-    wc(0, "");
+    wc(fdopen(0), "");
     exit();
   }
 
@@ -47,8 +43,8 @@ main(int argc, char *argv[])
       printf(1, "wc: cannot open %s\n", argv[i]);
       exit();
     }
-    wc(fd, argv[i]);
-    close(fd);
+    wc(fdopen(fd), argv[i]);
+    fclose(fdopen(fd));
   }
   exit();
 }
@@ -0,0 +1,120 @@
+// Working-set estimation.
+//
+// wsctl() picks one process to watch.  Every interval ticks, while
+// that process is running, its timer interrupt samples and clears
+// PTE_A on all of its resident pages and bumps a per-page counter
+// for each page found referenced.  wsread() returns the counters,
+// i.e. in how many samples each page was used, from which the
+// caller can estimate the working set and draw a heat map.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "memlayout.h"
+#include "mmu.h"
+#include "x86.h"
+#include "proc.h"
+#include "spinlock.h"
+#include "wset.h"
+
+struct {
+  struct spinlock lock;
+  int pid;
+  uint interval;
+  uint last;          // ticks at the last sample
+  uint samples;
+  uint npages;        // highest page index seen + 1
+  uchar *counts;      // one saturating counter per page, a kalloc'd page
+} ws;
+
+void
+wsinit(void)
+{
+  initlock(&ws.lock, "wset");
+}
+
+// Start sampling process pid every interval ticks, discarding any
+// earlier counters.  pid 0 or interval <= 0 stops sampling.
+int
+wsctl(int pid, int interval)
+{
+  char *mem;
+
+  mem = 0;
+  if(pid != 0 && interval > 0){
+    if((mem = kalloc()) == 0)
+      return -1;
+    memset(mem, 0, PGSIZE);
+  }
+
+  acquire(&ws.lock);
+  if(ws.counts)
+    kfree((char*)ws.counts);
+  ws.counts = (uchar*)mem;
+  ws.pid = mem ? pid : 0;
+  ws.interval = interval;
+  ws.last = ticks;
+  ws.samples = 0;
+  ws.npages = 0;
+  release(&ws.lock);
+  return 0;
+}
+
+// Copy out the state and up to n counters to st and buf, which
+// may be user memory.  Returns the number of counters copied.
+int
+wsread(struct wsstat *st, uchar *buf, int n)
+{
+  struct wsstat s;
+  uchar tmp[64];
+  int i, m;
+
+  acquire(&ws.lock);
+  s.pid = ws.pid;
+  s.interval = ws.interval;
+  s.samples = ws.samples;
+  s.npages = ws.npages;
+  release(&ws.lock);
+  // Touching user memory may fault and sleep, so never do it
+  // with ws.lock held.
+  *st = s;
+
+  if(n > s.npages)
+    n = s.npages;
+  for(i = 0; i < n; i += m){
+    m = n - i < sizeof(tmp) ? n - i : sizeof(tmp);
+    acquire(&ws.lock);
+    if(ws.counts == 0 || ws.pid != s.pid){
+      release(&ws.lock);
+      break;
+    }
+    memmove(tmp, ws.counts + i, m);
+    release(&ws.lock);
+    memmove(buf + i, tmp, m);
+  }
+  return i;
+}
+
+// Called from every CPU's timer interrupt.  Samples the current
+// process if it is the one being watched and a sample is due.
+void
+wstick(void)
+{
+  struct proc *p = myproc();
+  uint n;
+
+  if(p == 0 || ws.pid == 0 || p->pid != ws.pid)
+    return;
+
+  acquire(&ws.lock);
+  if(p->pid == ws.pid && ws.counts && ticks - ws.last >= ws.interval){
+    ws.last = ticks;
+    ws.samples++;
+    n = repl_wssample(p->pgdir, p->sz, ws.counts, WS_MAXPAGES);
+    if(n > ws.npages)
+      ws.npages = n;
+    // Entries cached in the TLB would not set PTE_A again.
+    lcr3(V2P(p->pgdir));
+  }
+  release(&ws.lock);
+}
@@ -0,0 +1,10 @@
+// Working-set sampling of one process at a time; see wset.c.
+#define WS_MAXPAGES  4096  // pages of address space covered
+
+// Returned by wsread().
+struct wsstat {
+  int pid;          // process being sampled, 0 if none
+  uint interval;    // ticks between samples
+  uint samples;     // samples taken so far
+  uint npages;      // pages of address space covered
+};